@@ -0,0 +1,33 @@
+#ifndef Archive_h
+#define Archive_h
+
+#include <stdint.h>
+
+/* One point of a query result, time in ms (or shot id for the overview) */
+struct archive_point {
+    uint32_t t;
+    float min;
+    float max;
+    float mean;
+};
+
+enum archive_level_e {
+    ARCHIVE_LEVEL_RAW,
+    ARCHIVE_LEVEL_BUCKETS,
+    ARCHIVE_LEVEL_SHOTS
+};
+
+typedef void (*archive_point_cb)(void *ctx, const struct archive_point *p);
+
+void archive_setup(void);
+void archive_begin(float setpoint, unsigned long start);
+void archive_add_sample(unsigned long time, float weight);
+void archive_end(bool keep, float dose);
+uint32_t archive_first_shot(void);
+uint32_t archive_last_shot(void);
+int archive_query_shot(uint32_t shot, uint32_t from, uint32_t to,
+                       unsigned int points, archive_point_cb cb, void *ctx);
+int archive_query_overview(uint32_t from, uint32_t to, unsigned int points,
+                           archive_point_cb cb, void *ctx);
+
+#endif
@@ -3,6 +3,20 @@
 
 #define HTTP_PORT   80
 
+#define FIRMWARE_VERSION    "1.0.0"
+
+/* mDNS, the name gets the chip id appended to be unique per scale */
+#define MDNS_NAME           "SmartScale"
+#define API_CAPABILITIES    "get_data,weight,tare,tare_status,toggle_relay,reset_relay," \
+                            "set_weight_setpoint,stats,perf,trace,safety,curves,time,events"
+#define EVENTS_INTERVAL     100     /* Min ms between /events messages */
+#define EVENTS_MAX_CLIENTS  2       /* Further /events subscribers are dropped */
+
+/* Serial port speed for the text console and binary telemetry */
+#define SERIAL_BAUD         9600
+#define TELEMETRY_BAUD      921600
+#define TELEMETRY_TX_BUFFER 1024
+
 /* Pins to use for the hardware connections */
 #define HX711_DOUT  4 /* D2 */
 #define HX711_SCK   5 /* D3 */
@@ -21,11 +35,67 @@
 #define EEP_SETPOINT_SIZE               4
 #define EEP_TIMER_THRESHOLD_ADDR        ((EEP_SETPOINT_ADDR) + (EEP_TIMER_THRESHOLD_SIZE))
 #define EEP_TIMER_THRESHOLD_SIZE        4
+#define EEP_CONTAINERS_ADDR             ((EEP_TIMER_THRESHOLD_ADDR) + (EEP_TIMER_THRESHOLD_SIZE))
+#define EEP_CONTAINERS_SIZE             ((CONTAINER_MAX) * 4)
 #define EEP_CRC32_ADDR                  ((EEP_SIZE) - 4)
 #define EEP_CRC32_SIZE                  4
 
+/*
+ * Load cell sample paths. The decision path feeds the cutoff and uses the
+ * library's dataset of LOADCELL_DECISION_SAMPLES plus the highest and
+ * lowest sample, which are dropped (1 gives a median of 3). The display
+ * path is a moving average of the decision path, updated every
+ * DISPLAY_DECIMATION samples. Tares use LOADCELL_TARE_SAMPLES.
+ */
+#define LOADCELL_DECISION_SAMPLES   1
+#define LOADCELL_TARE_SAMPLES       8
+#define DISPLAY_AVERAGE_SAMPLES     16
+#define DISPLAY_DECIMATION          4
+#define CONTROL_DELAY_COMPENSATION  1       /* Cut earlier by the filter delay */
+
+/* The dose is the display weight once it has settled after the cutoff */
+#define DOSE_STABLE_BAND    0.1f    /* Grams */
+#define DOSE_STABLE_TIME    500     /* ms */
+
+/* Container recognition */
+#define CONTAINER_MAX           8       /* Known containers */
+#define CONTAINER_TOLERANCE     1.0f    /* Match window in grams */
+#define CONTAINER_MIN_WEIGHT    15.0f   /* Lighter tares are not learned */
+#define CONTAINER_STABLE_BAND   0.3f    /* Grams */
+#define CONTAINER_STABLE_TIME   500     /* ms */
+#define CONTAINER_STEP_TIME     1000    /* Slower weight changes are doses, ms */
+
 /* Limit the weight setpoint */
 #define WEIGHT_LIMIT_MIN    5.0f
 #define WEIGHT_LIMIT_MAX    30.0f
 
+/* Relay watchdog, all times in ms */
+#define SAFETY_TICK                 1       /* Timer interrupt period */
+#define SAFETY_SAMPLE_DEADLINE      250     /* Max age of the latest sample */
+#define SAFETY_MAX_ON_TIME          30000   /* Max grind duration */
+
+/* Event tracing, only used when built with -DTRACE_ENABLE */
+#define TRACE_BUFFER_SIZE           1024    /* Events, 8 bytes each */
+#define TRACE_POST_TRIGGER          128     /* Events kept after a trigger */
+#define TRACE_MIN_SPAN_CYCLES       4000    /* 50 us at 80 MHz */
+#define TRACE_OVERSHOOT_THRESHOLD   0.5f    /* Grams above the setpoint */
+#define TRACE_GRIND_MIN_TIME        1000    /* Shorter "grinds" are placements, ms */
+#define TRACE_GRIND_MAX_CUTOFF      3.0f    /* Grams above the setpoint at cutoff */
+#define TRACE_LATENCY_THRESHOLD     50000   /* Sample to decision, us */
+
+/* Grind curve archive on LittleFS */
+#define ARCHIVE_BUFFER_SIZE         4096    /* Compressed bytes per shot */
+#define ARCHIVE_BLOCK_SAMPLES       64      /* Samples per compressed block */
+#define ARCHIVE_MAX_BLOCKS          64
+#define ARCHIVE_BUCKETS             32      /* Min/max/mean buckets per shot */
+#define ARCHIVE_MAX_SHOTS           400
+#define ARCHIVE_SEGMENT_SIZE        32768   /* Shots are appended to segment files */
+#define ARCHIVE_MIN_FREE            16384   /* Bytes kept free on LittleFS */
+#define ARCHIVE_MAX_POINTS          400     /* Max points per query */
+
+/* Shot statistics */
+#define STATS_EWMA_SPAN     10      /* Span in shots of the recent average */
+#define STATS_BIN_WIDTH     1.0f    /* Setpoint bin width in grams */
+#define STATS_NUM_BINS      ((int)((WEIGHT_LIMIT_MAX - WEIGHT_LIMIT_MIN) / STATS_BIN_WIDTH) + 1)
+
 #endif
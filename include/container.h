@@ -0,0 +1,11 @@
+#ifndef Container_h
+#define Container_h
+
+void container_setup(void);
+void container_tare_done(void);
+void container_sample(float weight);
+int container_get_active(void);
+float container_get_weight(int i);
+unsigned long container_get_matches(void);
+
+#endif
@@ -6,9 +6,13 @@ void control_setup(void);
 void control_set_setpoint(float setpoint);
 void control_set_relay(void);
 void control_reset_relay(void);
+void control_cancel_session(void);
 float control_get_setpoint(void);
 bool control_get_relay(void);
 unsigned int control_get_elapsed_time(void);
+unsigned long control_get_max_latency(void);
+unsigned long control_get_max_loop_time(void);
+void control_reset_perf(void);
 
 
 #endif
\ No newline at end of file
@@ -10,6 +10,9 @@ float eeprom_calfactor_get(void);
 void eeprom_timer_threshold_set(float t);
 float eeprom_timer_threshold_get(void);
 
+void eeprom_containers_set(const float *c, int n);
+float eeprom_container_get(int i);
+
 void eeprom_setup(void);
 
 #endif
@@ -1,9 +1,28 @@
 #ifndef LoadCell_h
 #define LoadCell_h
 
+#include <stdint.h>
+
+/* A weight stamped with its sequence number and acquisition time (ms) */
+struct loadcell_sample {
+    uint32_t seq;
+    uint32_t time;
+    float weight;
+};
+
 void loadcell_setup(void);
 void loadcell_loop(void);
 float loadcell_get_weight(void);
+float loadcell_get_display_weight(void);
+void loadcell_get_sample(struct loadcell_sample *s);
+void loadcell_get_display_sample(struct loadcell_sample *s);
+float loadcell_get_decision_delay(void);
+float loadcell_get_display_delay(void);
+float loadcell_get_sample_interval(void);
+unsigned long loadcell_get_sample_time(void);
+long loadcell_get_tare_offset(void);
+void loadcell_set_tare_offset(long offset);
+float loadcell_get_calfactor(void);
 void loadcell_tare(void);
 bool loadcell_tare_status(void);
 
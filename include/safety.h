@@ -0,0 +1,18 @@
+#ifndef Safety_h
+#define Safety_h
+
+enum safety_reason_e {
+    SAFETY_TRIP_STALE_SAMPLE,
+    SAFETY_TRIP_MAX_ON_TIME,
+    SAFETY_NUM_REASONS
+};
+
+void safety_setup(void);
+void safety_arm(void);
+void safety_disarm(void);
+void safety_sample(void);
+bool safety_armed(void);
+unsigned long safety_get_trips(enum safety_reason_e reason);
+unsigned long safety_get_max_gap(void);
+
+#endif
@@ -0,0 +1,36 @@
+#ifndef SafetyCheck_h
+#define SafetyCheck_h
+
+#include <stdint.h>
+
+#include "config.h"
+#include "safety.h"
+
+/* Lets the native test build include this without the ESP8266 core */
+#ifndef ICACHE_RAM_ATTR
+#define ICACHE_RAM_ATTR
+#endif
+
+/*
+ * Trip decision of the relay watchdog, kept free of hardware access so it
+ * can be unit tested on the host. All times are 32 bit millis() values,
+ * as on the ESP8266, also in the native build. Returns true
+ * and sets *reason if the grinder must be cut at time now.
+ * Called from the timer interrupt, so it lives in RAM if not inlined.
+ */
+static inline ICACHE_RAM_ATTR bool safety_check(uint32_t now,
+                                                uint32_t sample_time,
+                                                uint32_t arm_time,
+                                                enum safety_reason_e *reason)
+{
+    if (now - sample_time > SAFETY_SAMPLE_DEADLINE)
+        *reason = SAFETY_TRIP_STALE_SAMPLE;
+    else if (now - arm_time >= SAFETY_MAX_ON_TIME)
+        *reason = SAFETY_TRIP_MAX_ON_TIME;
+    else
+        return false;
+
+    return true;
+}
+
+#endif
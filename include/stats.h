@@ -0,0 +1,28 @@
+#ifndef Stats_h
+#define Stats_h
+
+enum stats_metric_e {
+    STATS_DOSE,
+    STATS_OVERSHOOT,
+    STATS_GRIND_TIME,
+    STATS_FLOW,
+    STATS_NUM_METRICS
+};
+
+struct stats_summary {
+    unsigned long count;
+    float mean;
+    float stddev;
+};
+
+void stats_add_shot(float setpoint, float dose, float cutoff_weight,
+                    unsigned int grind_time);
+void stats_reset(void);
+unsigned long stats_get_shot_count(void);
+const char *stats_metric_name(enum stats_metric_e m);
+void stats_get_total(enum stats_metric_e m, struct stats_summary *s);
+void stats_get_recent(enum stats_metric_e m, struct stats_summary *s);
+float stats_bin_setpoint(int bin);
+void stats_get_bin(int bin, enum stats_metric_e m, struct stats_summary *s);
+
+#endif
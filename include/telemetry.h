@@ -0,0 +1,37 @@
+#ifndef Telemetry_h
+#define Telemetry_h
+
+#include <stdint.h>
+
+/* Packets sent by the scale */
+#define TELEMETRY_PKT_SAMPLE        0x01
+#define TELEMETRY_PKT_EVENT         0x02
+#define TELEMETRY_PKT_STATUS        0x03
+#define TELEMETRY_PKT_ACK           0x04
+
+/* Commands accepted from the host */
+#define TELEMETRY_CMD_TARE          0x81
+#define TELEMETRY_CMD_SETPOINT      0x82
+#define TELEMETRY_CMD_RESET_RELAY   0x83
+#define TELEMETRY_CMD_SET_RELAY     0x84
+#define TELEMETRY_CMD_STATUS        0x85
+#define TELEMETRY_CMD_EXIT          0x86
+
+/* Event identifiers in TELEMETRY_PKT_EVENT */
+enum telemetry_event_e {
+    TELEMETRY_EVENT_RELAY = 1,
+    TELEMETRY_EVENT_GRIND_START,
+    TELEMETRY_EVENT_CUTOFF,
+    TELEMETRY_EVENT_SHOT,
+    TELEMETRY_EVENT_TARE,
+    TELEMETRY_EVENT_SETPOINT
+};
+
+void telemetry_loop(void);
+void telemetry_enable(bool enable);
+bool telemetry_enabled(void);
+void telemetry_send_sample(uint32_t seq, unsigned long time, float weight);
+void telemetry_send_event(enum telemetry_event_e event, float value);
+unsigned long telemetry_get_dropped(void);
+
+#endif
@@ -0,0 +1,65 @@
+#ifndef Trace_h
+#define Trace_h
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Event tracing into a RAM ring buffer, timestamped with the CPU cycle
+ * counter. Build with -DTRACE_ENABLE to turn it on; otherwise all the
+ * TRACE_* macros expand to nothing. Keep the identifiers in sync with
+ * tools/trace2chrome.py.
+ */
+
+enum trace_id_e {
+    TRACE_ISR = 0,
+    TRACE_LOADCELL_UPDATE,
+    TRACE_FILTER,
+    TRACE_CONTROL,
+    TRACE_DECISION,
+    TRACE_RELAY,
+    TRACE_HTTP,
+    TRACE_FLASH,
+    TRACE_MDNS,
+    TRACE_TELEMETRY,
+    TRACE_TRIGGER,
+    TRACE_NUM_IDS
+};
+
+enum trace_type_e {
+    TRACE_TYPE_BEGIN = 0,
+    TRACE_TYPE_END,
+    TRACE_TYPE_INSTANT
+};
+
+#ifdef TRACE_ENABLE
+
+void trace_record(uint8_t id, uint8_t type);
+void trace_span(uint32_t start, uint8_t id);
+void trace_trigger(void);
+void trace_freeze(void);
+void trace_arm(void);
+bool trace_frozen(void);
+size_t trace_size(void);
+size_t trace_read(uint8_t *buf, size_t len, size_t index);
+
+#define TRACE_BEGIN(id)         trace_record((id), TRACE_TYPE_BEGIN)
+#define TRACE_END(id)           trace_record((id), TRACE_TYPE_END)
+#define TRACE_INSTANT(id)       trace_record((id), TRACE_TYPE_INSTANT)
+/* Spans are only recorded if they last at least TRACE_MIN_SPAN_CYCLES */
+#define TRACE_SPAN_START(t)     uint32_t t = ESP.getCycleCount()
+#define TRACE_SPAN_STOP(t, id)  trace_span((t), (id))
+#define TRACE_TRIGGER()         trace_trigger()
+
+#else
+
+#define TRACE_BEGIN(id)         do { } while (0)
+#define TRACE_END(id)           do { } while (0)
+#define TRACE_INSTANT(id)       do { } while (0)
+#define TRACE_SPAN_START(t)     do { } while (0)
+#define TRACE_SPAN_STOP(t, id)  do { } while (0)
+#define TRACE_TRIGGER()         do { } while (0)
+
+#endif
+
+#endif
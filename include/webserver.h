@@ -2,5 +2,6 @@
 #define WebServer_h
 
 void webserver_setup(void);
+void webserver_loop(void);
 
 #endif
\ No newline at end of file
@@ -0,0 +1,691 @@
+#include <Arduino.h>
+#include <FS.h>
+#include <LittleFS.h>
+
+#include "config.h"
+#include "archive.h"
+#include "telemetry.h"
+#include "trace.h"
+
+/*
+ * On-flash archive of grind curves, at three resolutions:
+ *
+ * - Raw samples, compressed Gorilla style: times as delta-of-delta and
+ *   weights (in 0.01 g) as deltas, both with a variable length prefix
+ *   code. Samples are split into blocks of ARCHIVE_BLOCK_SAMPLES that
+ *   start byte aligned with an uncompressed sample, so any block can be
+ *   decoded on its own.
+ * - ARCHIVE_BUCKETS min/max/mean buckets per shot, in the shot header.
+ * - One summary record per shot in a circular index file, for overviews
+ *   spanning many shots.
+ *
+ * A shot is compressed into RAM while grinding and only written to flash
+ * once it is complete, so the grind itself never waits for LittleFS.
+ *
+ * Completed shots are appended to segment files of up to
+ * ARCHIVE_SEGMENT_SIZE bytes, so they share LittleFS blocks instead of
+ * each taking at least one. Each shot is stored as struct shot_header,
+ * header.buckets buckets, header.blocks block index entries and the
+ * compressed data. The index record holds its segment and offset. When
+ * flash runs low, the oldest segment is removed as a whole.
+ *
+ * There is no wall clock, so times are ms since the start of the shot and
+ * shot start times are ms since boot.
+ */
+
+#define SHOT_MAGIC          0x56524353  /* "SCRV" */
+#define INDEX_PATH          "/curves/index.bin"
+#define CURVES_DIR          "/curves"
+#define BLOCK_MAX_BYTES     (ARCHIVE_BLOCK_SAMPLES * 9 + 8)
+
+struct shot_header {
+    uint32_t magic;
+    uint32_t id;
+    uint32_t start;
+    uint32_t duration;
+    float setpoint;
+    float dose;
+    uint16_t samples;
+    uint16_t blocks;
+    uint16_t buckets;
+    uint16_t data_size;
+};
+
+struct block_index {
+    uint32_t t0;
+    uint16_t offset;
+    uint16_t samples;
+};
+
+struct shot_record {
+    uint32_t id;
+    uint32_t segment;
+    uint32_t offset;
+    uint32_t start;
+    uint32_t duration;
+    float setpoint;
+    float dose;
+};
+
+/* Position of each part of a shot stored at offset in its segment */
+#define BUCKETS_POS(offset)     ((offset) + sizeof(struct shot_header))
+#define BLOCKS_POS(offset, h)   (BUCKETS_POS(offset) + \
+                                 (h)->buckets * sizeof(struct archive_point))
+#define DATA_POS(offset, h)     (BLOCKS_POS(offset, h) + \
+                                 (h)->blocks * sizeof(struct block_index))
+#define SHOT_SIZE(h)            (DATA_POS(0, h) + (h)->data_size)
+
+struct bit_reader {
+    const uint8_t *buf;
+    uint32_t pos;
+};
+
+/* Groups a time ordered stream of points into a bounded number of points */
+struct aggregator {
+    uint32_t from;
+    uint32_t span;
+    unsigned int points;
+    long current;
+    unsigned int n;
+    struct archive_point p;
+    archive_point_cb cb;
+    void *ctx;
+};
+
+static uint32_t g_next_id = 1;
+static uint32_t g_first_id = 1;
+
+/* Segments on flash, g_segment is the one being appended to */
+static uint32_t g_first_segment = 0;
+static uint32_t g_segment = 0;
+static uint32_t g_segment_size = 0;
+
+/* Shot being recorded */
+static bool g_recording = false;
+static bool g_full = false;
+static unsigned long g_start = 0;
+static float g_setpoint = 0.0f;
+static uint16_t g_samples = 0;
+static uint16_t g_blocks = 0;
+static uint16_t g_block_samples = 0;
+static uint32_t g_bitpos = 0;
+static uint32_t g_prev_t = 0;
+static int32_t g_prev_dt = 0;
+static int32_t g_prev_v = 0;
+static struct block_index g_index[ARCHIVE_MAX_BLOCKS];
+static uint8_t g_buf[ARCHIVE_BUFFER_SIZE];
+
+/* Scratch buffer for decoding a block read back from flash */
+static uint8_t g_block_buf[BLOCK_MAX_BYTES];
+
+static void put_bits(uint32_t value, int n)
+{
+    uint8_t mask;
+
+    while (n-- > 0) {
+        mask = 0x80 >> (g_bitpos & 7);
+        if ((value >> n) & 1)
+            g_buf[g_bitpos >> 3] |= mask;
+        else
+            g_buf[g_bitpos >> 3] &= ~mask;
+        g_bitpos++;
+    }
+}
+
+static uint32_t get_bits(struct bit_reader *r, int n)
+{
+    uint32_t value = 0;
+
+    while (n-- > 0) {
+        value = (value << 1) | ((r->buf[r->pos >> 3] >> (7 - (r->pos & 7))) & 1);
+        r->pos++;
+    }
+    return value;
+}
+
+/* Gorilla style prefix code: 0, 10 + 7 bits, 110 + 9, 1110 + 12, 1111 + 32 */
+static void put_var(int32_t v)
+{
+    if (v == 0) {
+        put_bits(0, 1);
+    } else if (v >= -63 && v <= 64) {
+        put_bits(0x2, 2);
+        put_bits(v & 0x7F, 7);
+    } else if (v >= -255 && v <= 256) {
+        put_bits(0x6, 3);
+        put_bits(v & 0x1FF, 9);
+    } else if (v >= -2047 && v <= 2048) {
+        put_bits(0xE, 4);
+        put_bits(v & 0xFFF, 12);
+    } else {
+        put_bits(0xF, 4);
+        put_bits(v, 32);
+    }
+}
+
+static int32_t get_signed(struct bit_reader *r, int n)
+{
+    int32_t v = get_bits(r, n);
+
+    if (v > (1 << (n - 1)))
+        v -= 1 << n;
+    return v;
+}
+
+static int32_t get_var(struct bit_reader *r)
+{
+    if (get_bits(r, 1) == 0)
+        return 0;
+    if (get_bits(r, 1) == 0)
+        return get_signed(r, 7);
+    if (get_bits(r, 1) == 0)
+        return get_signed(r, 9);
+    if (get_bits(r, 1) == 0)
+        return get_signed(r, 12);
+    return (int32_t)get_bits(r, 32);
+}
+
+static void aggregator_init(struct aggregator *a, uint32_t from, uint32_t to,
+                            unsigned int points, archive_point_cb cb, void *ctx)
+{
+    a->from = from;
+    a->span = to - from + 1;
+    a->points = points;
+    a->current = -1;
+    a->n = 0;
+    a->cb = cb;
+    a->ctx = ctx;
+}
+
+static void aggregator_flush(struct aggregator *a)
+{
+    if (a->n == 0)
+        return;
+    a->p.mean /= a->n;
+    a->cb(a->ctx, &a->p);
+    a->n = 0;
+}
+
+static void aggregator_add(struct aggregator *a, const struct archive_point *p)
+{
+    long slot = (long)((uint64_t)(p->t - a->from) * a->points / a->span);
+
+    if (slot != a->current) {
+        aggregator_flush(a);
+        a->current = slot;
+        a->p = *p;
+    } else {
+        if (p->min < a->p.min)
+            a->p.min = p->min;
+        if (p->max > a->p.max)
+            a->p.max = p->max;
+        a->p.mean += p->mean;
+    }
+    a->n++;
+}
+
+/* Decode one block, passing samples within [from, to] to either cb or agg */
+static void decode_block(const uint8_t *data, uint16_t samples, uint32_t from,
+                         uint32_t to, struct aggregator *agg,
+                         archive_point_cb cb, void *ctx)
+{
+    struct bit_reader r = { data, 0 };
+    struct archive_point p;
+    uint32_t t = 0;
+    int32_t dt = 0, v = 0;
+    uint16_t i;
+
+    for (i = 0; i < samples; ++i) {
+        if (i == 0) {
+            t = get_bits(&r, 32);
+            v = (int32_t)get_bits(&r, 32);
+        } else {
+            dt += get_var(&r);
+            t += dt;
+            v += get_var(&r);
+        }
+
+        if (t < from)
+            continue;
+        if (t > to)
+            return;
+
+        p.t = t;
+        p.min = p.max = p.mean = v / 100.0f;
+        if (agg)
+            aggregator_add(agg, &p);
+        else
+            cb(ctx, &p);
+    }
+}
+
+static String segment_path(uint32_t segment)
+{
+    return String(CURVES_DIR "/s") + String(segment) + ".bin";
+}
+
+static bool read_record(File &f, uint32_t id, struct shot_record *rec)
+{
+    if (!f.seek((id % ARCHIVE_MAX_SHOTS) * sizeof(*rec)))
+        return false;
+    if (f.read((uint8_t *)rec, sizeof(*rec)) != sizeof(*rec))
+        return false;
+    return rec->id == id;
+}
+
+static void write_record(const struct shot_record *rec)
+{
+    const uint32_t pos = (rec->id % ARCHIVE_MAX_SHOTS) * sizeof(*rec);
+    const struct shot_record empty = {};
+    File f;
+
+    f = LittleFS.open(INDEX_PATH, LittleFS.exists(INDEX_PATH) ? "r+" : "w+");
+    if (!f) {
+        if (!telemetry_enabled())
+            Serial.println("Failed to open curve index");
+        return;
+    }
+
+    /* Grow the file up to the slot, then overwrite it */
+    f.seek(0, SeekEnd);
+    while (f.size() < pos)
+        f.write((const uint8_t *)&empty, sizeof(empty));
+    f.seek(pos);
+    f.write((const uint8_t *)rec, sizeof(*rec));
+    f.close();
+}
+
+void archive_setup(void)
+{
+    struct shot_record rec;
+    uint32_t last = 0, first = 0;
+    unsigned int segment;
+    bool found = false;
+    Dir dir;
+    File f;
+
+    LittleFS.mkdir(CURVES_DIR);
+
+    /* Continue appending to the newest segment */
+    dir = LittleFS.openDir(CURVES_DIR);
+    while (dir.next()) {
+        if (sscanf(dir.fileName().c_str(), "s%u.bin", &segment) != 1)
+            continue;
+        if (!found || segment < g_first_segment)
+            g_first_segment = segment;
+        if (!found || segment >= g_segment) {
+            g_segment = segment;
+            g_segment_size = dir.fileSize();
+        }
+        found = true;
+    }
+
+    /* Curves are available for indexed shots whose segment still exists */
+    f = LittleFS.open(INDEX_PATH, "r");
+    if (f) {
+        while (f.read((uint8_t *)&rec, sizeof(rec)) == sizeof(rec)) {
+            if (rec.id == 0)
+                continue;
+            if (rec.id > last)
+                last = rec.id;
+            if (found && rec.segment >= g_first_segment &&
+                (first == 0 || rec.id < first))
+                first = rec.id;
+        }
+        f.close();
+    }
+
+    g_next_id = last + 1;
+    g_first_id = first ? first : g_next_id;
+    Serial.print("Curve archive: shots ");
+    Serial.print(g_first_id);
+    Serial.print(" to ");
+    Serial.println(last);
+}
+
+/* start is the acquisition time of the sample that started the grind */
+void archive_begin(float setpoint, unsigned long start)
+{
+    g_recording = true;
+    g_full = false;
+    g_start = start;
+    g_setpoint = setpoint;
+    g_samples = 0;
+    g_blocks = 0;
+    g_block_samples = 0;
+    g_bitpos = 0;
+}
+
+void archive_add_sample(unsigned long time, float weight)
+{
+    uint32_t t = time - g_start;
+    int32_t v = lroundf(weight * 100.0f);
+    int32_t dt;
+
+    if (!g_recording || g_full)
+        return;
+
+    /* Times are unsigned offsets, an older sample would wrap to ~2^32 */
+    if ((long)(time - g_start) < 0)
+        return;
+
+    if (g_block_samples == 0) {
+        /* New block, byte aligned and starting with a raw sample */
+        g_bitpos = (g_bitpos + 7) & ~7UL;
+        if (g_blocks == ARCHIVE_MAX_BLOCKS ||
+            g_bitpos + 64 > ARCHIVE_BUFFER_SIZE * 8) {
+            g_full = true;
+            return;
+        }
+        g_index[g_blocks].t0 = t;
+        g_index[g_blocks].offset = g_bitpos / 8;
+        g_index[g_blocks].samples = 0;
+        g_blocks++;
+        put_bits(t, 32);
+        put_bits(v, 32);
+        g_prev_dt = 0;
+    } else {
+        if (g_bitpos + 72 > ARCHIVE_BUFFER_SIZE * 8) {
+            g_full = true;
+            return;
+        }
+        dt = t - g_prev_t;
+        put_var(dt - g_prev_dt);
+        put_var(v - g_prev_v);
+        g_prev_dt = dt;
+    }
+
+    g_prev_t = t;
+    g_prev_v = v;
+    g_index[g_blocks - 1].samples++;
+    g_samples++;
+    if (++g_block_samples == ARCHIVE_BLOCK_SAMPLES)
+        g_block_samples = 0;
+}
+
+struct bucket_builder {
+    struct archive_point *buckets;
+    uint16_t n;
+};
+
+static void add_bucket(void *ctx, const struct archive_point *p)
+{
+    struct bucket_builder *b = (struct bucket_builder *)ctx;
+
+    if (b->n < ARCHIVE_BUCKETS)
+        b->buckets[b->n++] = *p;
+}
+
+/* Id of the first shot in a segment, the next id if it is empty */
+static uint32_t segment_first_id(uint32_t segment)
+{
+    struct shot_header header;
+    uint32_t id = g_next_id;
+    File f;
+
+    f = LittleFS.open(segment_path(segment).c_str(), "r");
+    if (f) {
+        if (f.read((uint8_t *)&header, sizeof(header)) == sizeof(header) &&
+            header.magic == SHOT_MAGIC)
+            id = header.id;
+        f.close();
+    }
+    return id;
+}
+
+static void drop_segment(void)
+{
+    uint32_t id;
+
+    LittleFS.remove(segment_path(g_first_segment).c_str());
+    g_first_segment++;
+
+    id = segment_first_id(g_first_segment);
+    if (id > g_first_id)
+        g_first_id = id;
+}
+
+/*
+ * Pick the segment for a shot of size bytes. A new segment is started
+ * when it doesn't fit in the current one, first dropping the oldest
+ * segments until a whole segment fits with ARCHIVE_MIN_FREE to spare.
+ */
+static void make_room(uint32_t size)
+{
+    FSInfo info;
+
+    if (g_segment_size > 0 && g_segment_size + size > ARCHIVE_SEGMENT_SIZE) {
+        g_segment++;
+        g_segment_size = 0;
+    }
+
+    if (g_segment_size == 0) {
+        while (g_first_segment < g_segment && LittleFS.info(info) &&
+               info.usedBytes + ARCHIVE_SEGMENT_SIZE + ARCHIVE_MIN_FREE > info.totalBytes)
+            drop_segment();
+    }
+
+    /*
+     * The index slot is about to be reused, that shot can't be found
+     * anymore. Drop segments left with only such shots.
+     */
+    if (g_first_id + ARCHIVE_MAX_SHOTS <= g_next_id) {
+        g_first_id = g_next_id + 1 - ARCHIVE_MAX_SHOTS;
+        while (g_first_segment < g_segment &&
+               segment_first_id(g_first_segment + 1) <= g_first_id)
+            drop_segment();
+    }
+}
+
+void archive_end(bool keep, float dose)
+{
+    struct archive_point buckets[ARCHIVE_BUCKETS];
+    struct bucket_builder builder = { buckets, 0 };
+    struct aggregator agg;
+    struct shot_header header;
+    struct shot_record rec;
+    uint16_t i;
+    File f;
+
+    if (!g_recording)
+        return;
+    g_recording = false;
+    if (!keep || g_samples < 2)
+        return;
+
+    TRACE_BEGIN(TRACE_FLASH);
+    header.magic = SHOT_MAGIC;
+    header.id = g_next_id;
+    header.start = g_start;
+    header.duration = g_prev_t;
+    header.setpoint = g_setpoint;
+    header.samples = g_samples;
+    header.blocks = g_blocks;
+    header.data_size = (g_bitpos + 7) / 8;
+
+    /* Build the bucket level from the compressed samples */
+    aggregator_init(&agg, 0, header.duration, ARCHIVE_BUCKETS, add_bucket, &builder);
+    for (i = 0; i < g_blocks; ++i)
+        decode_block(&g_buf[g_index[i].offset], g_index[i].samples, 0,
+                     header.duration, &agg, NULL, NULL);
+    aggregator_flush(&agg);
+    header.buckets = builder.n;
+
+    rec.id = header.id;
+    rec.start = header.start;
+    rec.duration = header.duration;
+    rec.setpoint = header.setpoint;
+    rec.dose = dose;
+    header.dose = rec.dose;
+
+    make_room(SHOT_SIZE(&header));
+
+    f = LittleFS.open(segment_path(g_segment).c_str(), "a");
+    if (!f) {
+        if (!telemetry_enabled())
+            Serial.println("Failed to write grind curve");
+        TRACE_END(TRACE_FLASH);
+        return;
+    }
+    rec.segment = g_segment;
+    rec.offset = f.size();
+    f.write((const uint8_t *)&header, sizeof(header));
+    f.write((const uint8_t *)buckets, header.buckets * sizeof(buckets[0]));
+    f.write((const uint8_t *)g_index, header.blocks * sizeof(g_index[0]));
+    f.write(g_buf, header.data_size);
+    g_segment_size = f.size();
+    f.close();
+
+    write_record(&rec);
+    g_next_id++;
+    TRACE_END(TRACE_FLASH);
+}
+
+uint32_t archive_first_shot(void)
+{
+    return g_first_id;
+}
+
+uint32_t archive_last_shot(void)
+{
+    return g_next_id - 1;
+}
+
+static bool read_block_index(File &f, uint32_t pos, uint16_t i,
+                             struct block_index *b)
+{
+    return f.seek(pos + i * sizeof(*b)) &&
+           f.read((uint8_t *)b, sizeof(*b)) == sizeof(*b);
+}
+
+int archive_query_shot(uint32_t shot, uint32_t from, uint32_t to,
+                       unsigned int points, archive_point_cb cb, void *ctx)
+{
+    struct shot_header header;
+    struct shot_record rec;
+    struct block_index b, next;
+    struct archive_point p;
+    struct aggregator agg;
+    uint32_t count = 0, block_end, blocks_pos;
+    uint16_t i, bytes;
+    int level;
+    File f;
+
+    if (shot < g_first_id || shot >= g_next_id)
+        return -1;
+
+    f = LittleFS.open(INDEX_PATH, "r");
+    if (!f)
+        return -1;
+    if (!read_record(f, shot, &rec)) {
+        f.close();
+        return -1;
+    }
+    f.close();
+
+    f = LittleFS.open(segment_path(rec.segment).c_str(), "r");
+    if (!f)
+        return -1;
+    if (!f.seek(rec.offset) ||
+        f.read((uint8_t *)&header, sizeof(header)) != sizeof(header) ||
+        header.magic != SHOT_MAGIC || header.id != shot ||
+        header.blocks > ARCHIVE_MAX_BLOCKS) {
+        f.close();
+        return -1;
+    }
+    blocks_pos = BLOCKS_POS(rec.offset, &header);
+
+    if (to > header.duration)
+        to = header.duration;
+    if (from > to || points == 0) {
+        f.close();
+        return -1;
+    }
+
+    /* Count the raw samples in range using only the block index */
+    for (i = 0; i < header.blocks && read_block_index(f, blocks_pos, i, &b); ++i) {
+        block_end = (i + 1 < header.blocks && read_block_index(f, blocks_pos, i + 1, &next)) ?
+                    next.t0 : header.duration + 1;
+        if (b.t0 <= to && block_end > from)
+            count += b.samples;
+    }
+
+    aggregator_init(&agg, from, to, points, cb, ctx);
+
+    if (count > points && header.buckets > 0 &&
+        (uint64_t)header.buckets * (to - from + 1) >= (uint64_t)points * (header.duration + 1)) {
+        /* The bucket level has enough resolution for this range */
+        level = ARCHIVE_LEVEL_BUCKETS;
+        for (i = 0; i < header.buckets; ++i) {
+            if (!f.seek(BUCKETS_POS(rec.offset) + i * sizeof(p)) ||
+                f.read((uint8_t *)&p, sizeof(p)) != sizeof(p))
+                break;
+            if (p.t >= from && p.t <= to)
+                aggregator_add(&agg, &p);
+        }
+    } else {
+        /* Decode only the blocks overlapping the range */
+        level = ARCHIVE_LEVEL_RAW;
+        for (i = 0; i < header.blocks && read_block_index(f, blocks_pos, i, &b); ++i) {
+            if (i + 1 < header.blocks && read_block_index(f, blocks_pos, i + 1, &next)) {
+                block_end = next.t0;
+                bytes = next.offset - b.offset;
+            } else {
+                block_end = header.duration + 1;
+                bytes = header.data_size - b.offset;
+            }
+            if (b.t0 > to)
+                break;
+            if (block_end <= from || bytes > sizeof(g_block_buf))
+                continue;
+            if (!f.seek(DATA_POS(rec.offset, &header) + b.offset) ||
+                f.read(g_block_buf, bytes) != bytes)
+                break;
+            decode_block(g_block_buf, b.samples, from, to,
+                         count > points ? &agg : NULL, cb, ctx);
+        }
+    }
+
+    aggregator_flush(&agg);
+    f.close();
+    return level;
+}
+
+int archive_query_overview(uint32_t from, uint32_t to, unsigned int points,
+                           archive_point_cb cb, void *ctx)
+{
+    struct shot_record rec;
+    struct archive_point p;
+    struct aggregator agg;
+    uint32_t id;
+    File f;
+
+    /*
+     * The index keeps the last ARCHIVE_MAX_SHOTS summaries, even for shots
+     * whose curves have been dropped to free flash.
+     */
+    if (to > archive_last_shot())
+        to = archive_last_shot();
+    if (to >= ARCHIVE_MAX_SHOTS && from <= to - ARCHIVE_MAX_SHOTS)
+        from = to - ARCHIVE_MAX_SHOTS + 1;
+    if (from == 0)
+        from = 1;
+    if (from > to || points == 0)
+        return -1;
+
+    f = LittleFS.open(INDEX_PATH, "r");
+    if (!f)
+        return -1;
+
+    aggregator_init(&agg, from, to, points, cb, ctx);
+    for (id = from; id <= to; ++id) {
+        if (!read_record(f, id, &rec))
+            continue;
+        p.t = id;
+        p.min = p.max = p.mean = rec.dose;
+        aggregator_add(&agg, &p);
+    }
+    aggregator_flush(&agg);
+    f.close();
+    return ARCHIVE_LEVEL_SHOTS;
+}
@@ -0,0 +1,155 @@
+#include <Arduino.h>
+
+#include "config.h"
+#include "container.h"
+#include "control.h"
+#include "eeprom.h"
+#include "loadcell.h"
+
+/*
+ * Table of known container weights (portafilters, dosing cups), most
+ * recently used first. Weights are in grams relative to the empty
+ * platform, whose tare offset is taken at startup and whenever the empty
+ * platform is tared.
+ *
+ * Every completed tare with a container on the platform teaches the
+ * table its weight. When a stable weight that matches a known container
+ * is put on the platform, the tare offset is set directly, without
+ * waiting for the load cell library to collect a new tare dataset.
+ */
+
+static float g_weights[CONTAINER_MAX];
+static long g_empty_offset = 0;
+static int g_active = -1;
+static unsigned long g_matches = 0;
+
+/* Stability tracking */
+static float g_ref_weight = 0.0f;
+static unsigned long g_ref_time = 0;
+static unsigned long g_step_start = 0;
+static bool g_checked = false;
+
+void container_setup(void)
+{
+    int i;
+
+    for (i = 0; i < CONTAINER_MAX; ++i)
+        g_weights[i] = eeprom_container_get(i);
+
+    /* The scale is tared at startup, assume the platform is empty */
+    g_empty_offset = loadcell_get_tare_offset();
+}
+
+static float offset_to_weight(long offset)
+{
+    return (offset - g_empty_offset) / loadcell_get_calfactor();
+}
+
+static void set_zero(float weight)
+{
+    loadcell_set_tare_offset(g_empty_offset + lroundf(weight * loadcell_get_calfactor()));
+    control_cancel_session();
+}
+
+void container_tare_done(void)
+{
+    float weight = offset_to_weight(loadcell_get_tare_offset());
+    int i, found = CONTAINER_MAX - 1;
+
+    g_checked = true;
+
+    if (fabsf(weight) < CONTAINER_TOLERANCE) {
+        /* Empty platform, track drift of the zero point */
+        g_empty_offset = loadcell_get_tare_offset();
+        g_active = -1;
+        return;
+    }
+
+    if (weight < CONTAINER_MIN_WEIGHT) {
+        g_active = -1;
+        return;
+    }
+
+    for (i = 0; i < CONTAINER_MAX; ++i) {
+        if (fabsf(g_weights[i] - weight) < CONTAINER_TOLERANCE) {
+            found = i;
+            break;
+        }
+    }
+
+    /* Move it to the front, dropping the least recently used if new */
+    for (i = found; i > 0; --i)
+        g_weights[i] = g_weights[i - 1];
+    g_weights[0] = weight;
+    g_active = 0;
+
+    eeprom_containers_set(g_weights, CONTAINER_MAX);
+}
+
+static void container_match(float weight)
+{
+    float absolute;
+    int i;
+
+    if (fabsf(weight) < CONTAINER_MIN_WEIGHT - CONTAINER_TOLERANCE)
+        return;
+
+    absolute = weight + offset_to_weight(loadcell_get_tare_offset());
+    if (fabsf(absolute) < CONTAINER_TOLERANCE) {
+        /* Container removed */
+        set_zero(0.0f);
+        g_active = -1;
+        return;
+    }
+
+    for (i = 0; i < CONTAINER_MAX; ++i) {
+        if (g_weights[i] >= CONTAINER_MIN_WEIGHT &&
+            fabsf(absolute - g_weights[i]) < CONTAINER_TOLERANCE) {
+            set_zero(g_weights[i]);
+            g_active = i;
+            g_matches++;
+            return;
+        }
+    }
+}
+
+void container_sample(float weight)
+{
+    if (!loadcell_tare_status())
+        return;
+
+    if (fabsf(weight - g_ref_weight) > CONTAINER_STABLE_BAND) {
+        /* Leaving a stable weight */
+        if (g_checked)
+            g_step_start = millis();
+        g_ref_weight = weight;
+        g_ref_time = millis();
+        g_checked = false;
+    } else if (!g_checked && millis() - g_ref_time >= CONTAINER_STABLE_TIME) {
+        g_checked = true;
+        /*
+         * Containers are put down in one go, while a dose builds up over
+         * seconds of grinding. Light cups can weigh about as much as a
+         * dose, so only quick steps are matched.
+         */
+        if (g_ref_time - g_step_start <= CONTAINER_STEP_TIME)
+            container_match(weight);
+    }
+}
+
+int container_get_active(void)
+{
+    return g_active;
+}
+
+float container_get_weight(int i)
+{
+    if (i < 0 || i >= CONTAINER_MAX)
+        return 0.0f;
+    return g_weights[i];
+}
+
+unsigned long container_get_matches(void)
+{
+    return g_matches;
+}
@@ -5,11 +5,28 @@
 #include "loadcell.h"
 #include "config.h"
 #include "eeprom.h"
+#include "stats.h"
+#include "safety.h"
+#include "archive.h"
+#include "telemetry.h"
+#include "trace.h"
 
 #define PRINT_INTERVAL  1000
 
 static unsigned int g_timer_start = 0;
 static unsigned int g_timer_stop = 0;
+static float g_cutoff_setpoint = 0.0f;
+static float g_cutoff_weight = 0.0f;
+static float g_peak_weight = 0.0f;
+static uint32_t g_decided_seq = 0;
+static float g_dose = 0.0f;
+static bool g_dose_settled = false;
+static float g_settle_weight = 0.0f;
+static unsigned long g_settle_time = 0;
+
+/* Worst case sample-to-decision latency and loop period, in us */
+static unsigned long g_max_latency = 0;
+static unsigned long g_max_loop_time = 0;
 
 enum timer_state_e {
         WAITING,
@@ -32,14 +49,32 @@ bool control_get_relay(void)
 
 void control_set_relay(void)
 {
+    if (!control_get_relay()) {
+        TRACE_INSTANT(TRACE_RELAY);
+        telemetry_send_event(TELEMETRY_EVENT_RELAY, 1.0f);
+    }
     digitalWrite(RELAY_PIN, 1);
 }
 
 void control_reset_relay(void)
 {
+    if (control_get_relay()) {
+        TRACE_INSTANT(TRACE_RELAY);
+        telemetry_send_event(TELEMETRY_EVENT_RELAY, 0.0f);
+    }
     digitalWrite(RELAY_PIN, 0);
 }
 
+/* Forget the current grind, e.g. when the scale has been re-zeroed */
+void control_cancel_session(void)
+{
+    if (g_tstate == WAITING)
+        return;
+    safety_disarm();
+    archive_end(false, 0.0f);
+    g_tstate = WAITING;
+}
+
 unsigned int control_get_elapsed_time(void)
 {
 #ifdef DEBUG
@@ -59,37 +94,179 @@ unsigned int control_get_elapsed_time(void)
         return 0;
 }
 
+unsigned long control_get_max_latency(void)
+{
+    return g_max_latency;
+}
+
+unsigned long control_get_max_loop_time(void)
+{
+    return g_max_loop_time;
+}
+
+void control_reset_perf(void)
+{
+    g_max_latency = 0;
+    g_max_loop_time = 0;
+}
+
+static void control_update_perf(void)
+{
+    static unsigned long last_sample = 0;
+    static unsigned long last_call = micros();
+    unsigned long now = micros();
+
+    if (now - last_call > g_max_loop_time)
+        g_max_loop_time = now - last_call;
+    last_call = now;
+
+    /* Time from the HX711 data ready interrupt to the relay decision */
+    if (loadcell_get_sample_time() != last_sample) {
+        last_sample = loadcell_get_sample_time();
+        TRACE_INSTANT(TRACE_DECISION);
+        if (now - last_sample > g_max_latency)
+            g_max_latency = now - last_sample;
+        if (now - last_sample > TRACE_LATENCY_THRESHOLD)
+            TRACE_TRIGGER();
+    }
+}
+
+/*
+ * Weight used for the cutoff. While grinding, the decision filter's group
+ * delay is made up for with the average flow since the grind started.
+ */
+static float control_get_weight(void)
+{
+    float w = loadcell_get_weight();
+#if CONTROL_DELAY_COMPENSATION
+    unsigned int elapsed = millis() - g_timer_start;
+
+    if (g_tstate == RUNNING && elapsed > 0 && w > 0.0f)
+        w += w / elapsed * loadcell_get_decision_delay();
+#endif
+    return w;
+}
+
+/*
+ * Coffee still in flight lands after the cutoff. Follow it on the display
+ * path, whose averaging keeps noise out of the peak and the dose, which is
+ * taken once the reading has stayed within DOSE_STABLE_BAND for
+ * DOSE_STABLE_TIME.
+ */
+/*
+ * Putting a cup or portafilter on the scale also runs WAITING -> RUNNING
+ * -> STOPPED, within a few samples and far past the setpoint. Only a
+ * real grind's overshoot is worth freezing the trace for.
+ */
+static bool control_plausible_grind(void)
+{
+    return g_timer_stop - g_timer_start >= TRACE_GRIND_MIN_TIME &&
+           g_cutoff_weight <= g_cutoff_setpoint + TRACE_GRIND_MAX_CUTOFF;
+}
+
+static void control_start_dose(void)
+{
+    g_peak_weight = loadcell_get_display_weight();
+    g_settle_weight = g_peak_weight;
+    g_settle_time = millis();
+    g_dose_settled = false;
+}
+
+static void control_track_dose(void)
+{
+    float w = loadcell_get_display_weight();
+
+    if (w > g_peak_weight) {
+        g_peak_weight = w;
+        if (g_peak_weight > g_cutoff_setpoint + TRACE_OVERSHOOT_THRESHOLD &&
+            control_plausible_grind())
+            TRACE_TRIGGER();
+    }
+
+    if (fabsf(w - g_settle_weight) > DOSE_STABLE_BAND) {
+        g_settle_weight = w;
+        g_settle_time = millis();
+    } else if (millis() - g_settle_time >= DOSE_STABLE_TIME) {
+        g_dose = w;
+        g_dose_settled = true;
+    }
+}
+
 void control_loop(void)
 {
     static unsigned int t = millis();
+    struct loadcell_sample s;
+    TRACE_SPAN_START(span);
 
-    if (loadcell_get_weight() >= eeprom_setpoint_get()) {
-         if (millis() > t + PRINT_INTERVAL) { 
+    if (control_get_weight() >= eeprom_setpoint_get()) {
+         if (!telemetry_enabled() && millis() > t + PRINT_INTERVAL) { 
             Serial.println("Weight setpoint exceeded.");
             t = millis();
         }
         control_set_relay();
     }
 
+    /* The relay watchdog only learns about a sample once it's been decided on */
+    loadcell_get_sample(&s);
+    if (s.seq != g_decided_seq) {
+        g_decided_seq = s.seq;
+        safety_sample();
+    }
+
+    control_update_perf();
+
+    /* Whatever is on the scale while taring is a container, not a grind */
+    if (!loadcell_tare_status()) {
+        control_cancel_session();
+        TRACE_SPAN_STOP(span, TRACE_CONTROL);
+        return;
+    }
+
     switch (g_tstate) {
     case WAITING:
         if (loadcell_get_weight() >= eeprom_timer_threshold_get()) {
            g_timer_start = millis();
            g_tstate = RUNNING;
+           if (!control_get_relay())
+               safety_arm();
+           archive_begin(eeprom_setpoint_get(), s.time);
+           archive_add_sample(s.time, s.weight);
+           telemetry_send_event(TELEMETRY_EVENT_GRIND_START, loadcell_get_weight());
         }
         break;
 
     case RUNNING:
-        if (loadcell_get_weight() >= eeprom_setpoint_get()) {
+        if (control_get_weight() >= eeprom_setpoint_get()) {
             g_timer_stop = millis();
+            g_cutoff_setpoint = eeprom_setpoint_get();
+            g_cutoff_weight = loadcell_get_weight();
+            control_start_dose();
             g_tstate = STOPPED;
+            safety_disarm();
+            telemetry_send_event(TELEMETRY_EVENT_CUTOFF, g_cutoff_weight);
         }
 
     case STOPPED:
+        if (g_tstate == STOPPED)
+            control_track_dose();
+
         if (loadcell_get_weight() <= eeprom_timer_threshold_get()) {
+            /* Cup lifted before the reading settled, use the peak */
+            float dose = g_dose_settled ? g_dose : g_peak_weight;
+
+            safety_disarm();
+            /* Only completed shots count, not aborted ones */
+            if (g_tstate == STOPPED) {
+                stats_add_shot(g_cutoff_setpoint, dose,
+                               g_cutoff_weight, g_timer_stop - g_timer_start);
+                telemetry_send_event(TELEMETRY_EVENT_SHOT, dose);
+            }
+            archive_end(g_tstate == STOPPED, dose);
             g_tstate = WAITING;
         }
         break;        
     }
+
+    TRACE_SPAN_STOP(span, TRACE_CONTROL);
 }
 
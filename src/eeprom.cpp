@@ -3,11 +3,14 @@
 #include <CRC32.h>
 
 #include "config.h"
+#include "telemetry.h"
+#include "trace.h"
 
 struct parameter_cache {
   float weight_setpoint;
   float calibration_factor;
   float timer_threshold;
+  float containers[CONTAINER_MAX];
 };
 
 static struct parameter_cache g_parameter_cache = { 0 };
@@ -26,17 +29,22 @@ static void eeprom_update_checksum(void)
     noInterrupts();
     EEPROM.put(EEP_CRC32_ADDR, checksum);
 #if defined(ESP8266) || defined(ESP32)
+    TRACE_BEGIN(TRACE_FLASH);
     EEPROM.commit();
+    TRACE_END(TRACE_FLASH);
 #endif
     interrupts();
-    Serial.printf("New CRC: %04X\n", checksum);
+    if (!telemetry_enabled())
+        Serial.printf("New CRC: %04X\n", checksum);
 }
 
 void eeprom_setpoint_set(float s)
 {
     if (s < WEIGHT_LIMIT_MIN || s > WEIGHT_LIMIT_MAX || isnan(s)) {
-        Serial.print("Invalid weight: ");
-        Serial.println(s);
+        if (!telemetry_enabled()) {
+            Serial.print("Invalid weight: ");
+            Serial.println(s);
+        }
         return;
     }
 
@@ -45,10 +53,13 @@ void eeprom_setpoint_set(float s)
         EEPROM.put(EEP_SETPOINT_ADDR, s);
         g_parameter_cache.weight_setpoint = s;
 #if defined(ESP8266) || defined(ESP32)
+        TRACE_BEGIN(TRACE_FLASH);
         EEPROM.commit();
+        TRACE_END(TRACE_FLASH);
 #endif
         interrupts();
         eeprom_update_checksum();
+        telemetry_send_event(TELEMETRY_EVENT_SETPOINT, s);
     }
 }
 
@@ -59,7 +70,9 @@ void eeprom_calfactor_set(float c)
       EEPROM.put(EEP_CALIBRATION_VALUE_ADDR, c);
       g_parameter_cache.calibration_factor = c;
 #if defined(ESP8266) || defined(ESP32)
+      TRACE_BEGIN(TRACE_FLASH);
       EEPROM.commit();
+      TRACE_END(TRACE_FLASH);
 #endif
       interrupts();
       eeprom_update_checksum();
@@ -73,13 +86,43 @@ void eeprom_timer_threshold_set(float t)
       EEPROM.put(EEP_TIMER_THRESHOLD_ADDR, t);
       g_parameter_cache.timer_threshold = t;
 #if defined(ESP8266) || defined(ESP32)
+      TRACE_BEGIN(TRACE_FLASH);
       EEPROM.commit();
+      TRACE_END(TRACE_FLASH);
 #endif
       interrupts();
       eeprom_update_checksum();
   }
 }
 
+void eeprom_containers_set(const float *c, int n)
+{
+    int i;
+
+    if (n > CONTAINER_MAX)
+        n = CONTAINER_MAX;
+    if (memcmp(c, g_parameter_cache.containers, n * sizeof(*c)) == 0)
+        return;
+
+    noInterrupts();
+    for (i = 0; i < n; ++i) {
+        EEPROM.put(EEP_CONTAINERS_ADDR + i * sizeof(float), c[i]);
+        g_parameter_cache.containers[i] = c[i];
+    }
+#if defined(ESP8266) || defined(ESP32)
+    TRACE_BEGIN(TRACE_FLASH);
+    EEPROM.commit();
+    TRACE_END(TRACE_FLASH);
+#endif
+    interrupts();
+    eeprom_update_checksum();
+}
+
+float eeprom_container_get(int i)
+{
+    return g_parameter_cache.containers[i];
+}
+
 float eeprom_timer_threshold_get(void)
 {
     return g_parameter_cache.timer_threshold;
@@ -97,13 +140,19 @@ float eeprom_calfactor_get(void)
 
 static void reset_eeprom(void)
 {
+    int i;
+
     Serial.println("EEPROM checksum invalid, restoring default values.");
     noInterrupts();
     EEPROM.put(EEP_SETPOINT_ADDR, DEFAULT_SETPOINT);
     EEPROM.put(EEP_CALIBRATION_VALUE_ADDR, DEFAULT_CALIBRATION_VALUE);
     EEPROM.put(EEP_TIMER_THRESHOLD_ADDR, DEFAULT_TIMER_THRESHOLD);
+    for (i = 0; i < CONTAINER_MAX; ++i)
+        EEPROM.put(EEP_CONTAINERS_ADDR + i * sizeof(float), 0.0f);
 #if defined(ESP8266) || defined(ESP32)
+    TRACE_BEGIN(TRACE_FLASH);
     EEPROM.commit();
+    TRACE_END(TRACE_FLASH);
 #endif
     interrupts();
     eeprom_update_checksum();
@@ -158,6 +207,12 @@ void eeprom_setup(void)
     } 
     g_parameter_cache.timer_threshold = tmp;
 
+    /* Unused slots read as erased flash */
+    for (i = 0; i < CONTAINER_MAX; ++i) {
+        EEPROM.get(EEP_CONTAINERS_ADDR + i * sizeof(float), tmp);
+        g_parameter_cache.containers[i] = (isnan(tmp) || tmp < 0.0f) ? 0.0f : tmp;
+    }
+
     eeprom_update_checksum();
 
     Serial.println("EEPROM starting values:");
@@ -6,14 +6,28 @@
 
 #include "config.h"
 #include "control.h"
+#include "loadcell.h"
 #include "eeprom.h"
+#include "telemetry.h"
+#include "trace.h"
+#include "archive.h"
+#include "container.h"
 
 //HX711 constructor:
 static HX711_ADC LoadCell(HX711_DOUT, HX711_SCK);
 
 static volatile boolean g_new_data_ready = false;
 static float g_last_weight = 0.0f;
-static bool g_update_data = false;
+static float g_display_weight = 0.0f;
+static uint32_t g_seq = 0;
+static uint32_t g_acq_time = 0;
+static struct loadcell_sample g_display_sample = { 0, 0, 0.0f };
+static float g_sample_interval = 0.0f;
+static volatile bool g_update_data = false;
+static volatile unsigned long g_isr_time = 0;
+static volatile unsigned long g_isr_millis = 0;
+static unsigned long g_sample_time = 0;
+static bool g_tare_pending = false;
 
 static void change_saved_cal_factor();
 static void calibrate();
@@ -25,8 +39,17 @@ ICACHE_RAM_ATTR void data_ready_isr()
      * Only signal the loop function to update the data in the ISR.
      * Previously the data was read from the ADC too, way too much to
      * do in an ISR.
+     *
+     * DOUT also falls on the data bits while LoadCell.update() clocks
+     * them out. Only the first edge, data ready, is stamped, so the
+     * latency and acquisition time include any wait for the readout.
      */
+    if (g_update_data)
+        return;
+    g_isr_time = micros();
+    g_isr_millis = millis();
     g_update_data = true;
+    TRACE_INSTANT(TRACE_ISR);
 }
 
 void loadcell_setup(void)
@@ -38,7 +61,7 @@ void loadcell_setup(void)
     calibration_value = eeprom_calfactor_get();
 
     LoadCell.begin();
-    LoadCell.setSamplesInUse(8);
+    LoadCell.setSamplesInUse(LOADCELL_TARE_SAMPLES);
     LoadCell.start(stabilizingtime, tare);
     if (LoadCell.getTareTimeoutFlag() || LoadCell.getSignalTimeoutFlag()) {
         Serial.println("Timeout, check MCU>HX711 wiring and pin designations");
@@ -48,18 +71,39 @@ void loadcell_setup(void)
         LoadCell.setCalFactor(calibration_value); // set calibration value (float)
         Serial.println("Startup is complete");
     }
+    LoadCell.setSamplesInUse(LOADCELL_DECISION_SAMPLES);
+
+    container_setup();
 
     attachInterrupt(digitalPinToInterrupt(HX711_DOUT), data_ready_isr, FALLING);    
 }
 
 void loadcell_tare(void)
 {
+    /* Tare on a larger dataset than the decision path uses */
+    LoadCell.setSamplesInUse(LOADCELL_TARE_SAMPLES);
     LoadCell.tareNoDelay();
+    g_tare_pending = true;
 }
 
 bool loadcell_tare_status(void)
 {
-    return LoadCell.getTareStatus();
+    return !g_tare_pending;
+}
+
+long loadcell_get_tare_offset(void)
+{
+    return LoadCell.getTareOffset();
+}
+
+void loadcell_set_tare_offset(long offset)
+{
+    LoadCell.setTareOffset(offset);
+}
+
+float loadcell_get_calfactor(void)
+{
+    return LoadCell.getCalFactor();
 }
 
 static void set_weight()
@@ -104,27 +148,135 @@ float loadcell_get_weight(void)
     return g_last_weight;
 }
 
+float loadcell_get_display_weight(void)
+{
+    return g_display_weight;
+}
+
+void loadcell_get_sample(struct loadcell_sample *s)
+{
+    s->seq = g_seq;
+    s->time = g_acq_time;
+    s->weight = g_last_weight;
+}
+
+/* The display value carries the stamp of the newest sample averaged into it */
+void loadcell_get_display_sample(struct loadcell_sample *s)
+{
+    *s = g_display_sample;
+}
+
+float loadcell_get_sample_interval(void)
+{
+    return g_sample_interval;
+}
+
+/* Group delay of the decision path in ms, (N + 1) / 2 samples */
+float loadcell_get_decision_delay(void)
+{
+    return (LOADCELL_DECISION_SAMPLES + 1) / 2.0f * g_sample_interval;
+}
+
+/* Decision path plus the moving average and the decimation hold */
+float loadcell_get_display_delay(void)
+{
+    return loadcell_get_decision_delay() +
+           ((DISPLAY_AVERAGE_SAMPLES - 1) + (DISPLAY_DECIMATION - 1)) / 2.0f *
+           g_sample_interval;
+}
+
+static void display_filter(float w)
+{
+    static float samples[DISPLAY_AVERAGE_SAMPLES];
+    static float sum = 0.0f;
+    static int index = 0;
+    static int count = 0;
+    static int decimation = 0;
+
+    if (count == DISPLAY_AVERAGE_SAMPLES)
+        sum -= samples[index];
+    else
+        count++;
+    samples[index] = w;
+    sum += w;
+    index = (index + 1) % DISPLAY_AVERAGE_SAMPLES;
+
+    if (++decimation >= DISPLAY_DECIMATION) {
+        decimation = 0;
+        g_display_weight = sum / count;
+        g_display_sample.seq = g_seq;
+        g_display_sample.time = g_acq_time;
+        g_display_sample.weight = g_display_weight;
+    }
+}
+
+static void update_sample_interval(unsigned long now)
+{
+    static unsigned long last = 0;
+    float interval = (now - last) / 1000.0f;
+
+    /* Skip the first sample and gaps from blocking serial prompts */
+    if (last != 0 && interval < 1000.0f) {
+        if (g_sample_interval == 0.0f)
+            g_sample_interval = interval;
+        else
+            g_sample_interval += (interval - g_sample_interval) / 16;
+    }
+    last = now;
+}
+
+unsigned long loadcell_get_sample_time(void)
+{
+    return g_sample_time;
+}
+
 void loadcell_loop(void)
 {
     const int serial_print_interval = 1000; //increase value to slow down serial print activity
     static unsigned int t = millis(); 
     static bool print_weight = true;
     bool new_data_ready = false;
+    unsigned long isr_time = 0, isr_millis = 0;
 
     if (g_update_data) {
+        /* Copy the stamp before the next data ready edge can replace it */
+        isr_time = g_isr_time;
+        isr_millis = g_isr_millis;
+        TRACE_BEGIN(TRACE_LOADCELL_UPDATE);
         if (LoadCell.update())
             new_data_ready = true;
         g_update_data = false;
+        TRACE_END(TRACE_LOADCELL_UPDATE);
     }
 
     // get smoothed value from the dataset:
     if (new_data_ready) {
+        TRACE_BEGIN(TRACE_FILTER);
         float f = LoadCell.getData();
         g_last_weight = f;
-        
-        if (print_weight && (millis() > (t + serial_print_interval))) { 
+        g_sample_time = isr_time;
+        g_acq_time = isr_millis;
+        g_seq++;
+        update_sample_interval(g_sample_time);
+        display_filter(f);
+        TRACE_END(TRACE_FILTER);
+        telemetry_send_sample(g_seq, g_acq_time, f);
+        archive_add_sample(g_acq_time, f);
+
+        if (g_tare_pending && LoadCell.getTareStatus()) {
+            g_tare_pending = false;
+            LoadCell.setSamplesInUse(LOADCELL_DECISION_SAMPLES);
+            control_cancel_session();
+            container_tare_done();
+            telemetry_send_event(TELEMETRY_EVENT_TARE, 0.0f);
+        }
+        /* Stability is judged on the averaged display path */
+        container_sample(g_display_weight);
+
+        if (print_weight && !telemetry_enabled() &&
+            (millis() > (t + serial_print_interval))) { 
             Serial.print("Measured weight: ");
-            Serial.println(f);
+            Serial.println(g_display_weight);
             //Serial.print("  ");
             //Serial.println(millis() - t);
             t = millis();
@@ -132,7 +284,8 @@ void loadcell_loop(void)
     }
 
     // receive command from serial terminal, send 't' to initiate tare operation:
-    if (Serial.available() > 0) {
+    // in binary telemetry mode the commands are handled by telemetry_loop()
+    if (!telemetry_enabled() && Serial.available() > 0) {
         char c = Serial.read();
         int i = 0;
 
@@ -147,6 +300,7 @@ void loadcell_loop(void)
             Serial.println("z    - reset wifi settings");
             Serial.println("p    - enable/disable weight output");
             Serial.println("s    - display stored parameters");
+            Serial.println("b    - switch to binary telemetry");
             break;
 
         case 's':
@@ -163,7 +317,11 @@ void loadcell_loop(void)
             break;
 
         case 't':
-            LoadCell.tareNoDelay();
+            loadcell_tare();
+            break;
+
+        case 'b':
+            telemetry_enable(true);
             break;
 
         case 'r':
@@ -207,6 +365,7 @@ static void calibrate()
     float known_mass = 0.0f;
     float new_cal_value;
 
+    LoadCell.setSamplesInUse(LOADCELL_TARE_SAMPLES);
     Serial.println("***");
     Serial.println("Start calibration:");
     Serial.println("Place the load cell an a level stable surface.");
@@ -272,6 +431,7 @@ static void calibrate()
         }
     }
 
+    LoadCell.setSamplesInUse(LOADCELL_DECISION_SAMPLES);
     Serial.println("End calibration");
     Serial.println("***");
     Serial.println("To re-calibrate, send 'r' from serial monitor.");
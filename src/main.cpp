@@ -12,19 +12,48 @@
 #include "control.h"
 #include "config.h"
 #include "eeprom.h"
+#include "telemetry.h"
+#include "trace.h"
+#include "safety.h"
+#include "archive.h"
 
 /* 
  * TODO:
  * - Calibrate from web page
  * - Make webpage look nicer
- * - mDNS / DNS server support
  */
 
+static MDNSResponder::hMDNSService g_mdns_service = 0;
+
+/* TXT values that can change, filled in whenever the service is announced */
+static void mdns_dynamic_txt(const MDNSResponder::hMDNSService service)
+{
+    if (service == g_mdns_service)
+        MDNS.addDynamicServiceTxt(service, "setpoint",
+                                  String(eeprom_setpoint_get(), 1).c_str());
+}
+
+/*
+ * Re-announce when the setpoint changes, so browsers see the new TXT
+ * record. Done from loop() as the setpoint is also set from web handlers.
+ */
+static void mdns_update(void)
+{
+    static float announced = 0.0f;
+
+    if (g_mdns_service && eeprom_setpoint_get() != announced) {
+        if (announced != 0.0f)
+            MDNS.announce();
+        announced = eeprom_setpoint_get();
+    }
+    MDNS.update();
+}
+
 void setup(void)
 {
-    String mdnsname = "SmartScale";
+    String mdnsname = String(MDNS_NAME) + "-" + String(ESP.getChipId(), HEX);
 
-    Serial.begin(9600);
+    Serial.begin(SERIAL_BAUD);
     /* Delay here to not miss any output as we go from upload mode
      * to monitor mode.
      */
@@ -40,15 +69,23 @@ void setup(void)
     loadcell_setup();
     Serial.println("Setting up Control loop..");
     control_setup();
+    Serial.println("Setting up relay watchdog...");
+    safety_setup();
     Serial.println("Setting up filesystem...");
     if (!LittleFS.begin()) {
         Serial.println("Failed to setup LittleFS!");
+    } else {
+        archive_setup();
     }
 
     if (MDNS.begin(mdnsname)) {
         Serial.print("mDNS service started: ");
         Serial.println(mdnsname);
-        MDNS.addService("http", "tcp", HTTP_PORT);
+        g_mdns_service = MDNS.addService(mdnsname.c_str(), "http", "tcp", HTTP_PORT);
+        MDNS.addServiceTxt(g_mdns_service, "fw", FIRMWARE_VERSION);
+        MDNS.addServiceTxt(g_mdns_service, "api", API_CAPABILITIES);
+        MDNS.addServiceTxt(g_mdns_service, "stream", "/events");
+        MDNS.setDynamicServiceTxtCallback(mdns_dynamic_txt);
     } else {
         Serial.println("Failed to start mDNS service");
     }
@@ -60,5 +97,14 @@ void loop(void)
 {
     loadcell_loop();
     control_loop();
-    MDNS.update();
+
+    TRACE_SPAN_START(telemetry_span);
+    telemetry_loop();
+    TRACE_SPAN_STOP(telemetry_span, TRACE_TELEMETRY);
+
+    webserver_loop();
+
+    TRACE_SPAN_START(mdns_span);
+    mdns_update();
+    TRACE_SPAN_STOP(mdns_span, TRACE_MDNS);
 }
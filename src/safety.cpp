@@ -0,0 +1,98 @@
+#include <Arduino.h>
+
+#include "config.h"
+#include "safety.h"
+#include "safety_check.h"
+
+/*
+ * Relay watchdog running from the hardware timer 1 interrupt, independent
+ * of loop(). While a grind is in progress it cuts the grinder (sets the
+ * relay, like control_loop() does at the setpoint) if control_loop() has
+ * not decided on a new sample within SAFETY_SAMPLE_DEADLINE ms, or if the
+ * grind has lasted SAFETY_MAX_ON_TIME ms, see safety_check(). The
+ * worst-case cutoff is therefore the deadline plus one timer tick, plus
+ * any time spent with interrupts disabled.
+ *
+ * The setpoint itself is left to control_loop(), which reports samples
+ * only after its cutoff decision. Checking it here as well would race
+ * the control loop and count ordinary cutoffs as trips.
+ *
+ * The ISR only touches integers in RAM, so that it doesn't depend on
+ * code in flash. Timer 1 is also used by analogWrite() and tone(), which
+ * this project doesn't use.
+ */
+
+#define TIMER_TICKS_PER_MS  5000    /* 80 MHz / 16 */
+
+static volatile bool g_armed = false;
+static volatile uint32_t g_sample_time = 0;
+static volatile uint32_t g_arm_time = 0;
+static volatile unsigned long g_max_gap = 0;
+static volatile unsigned long g_trips[SAFETY_NUM_REASONS];
+
+static ICACHE_RAM_ATTR void safety_isr(void)
+{
+    uint32_t now, gap;
+    enum safety_reason_e reason;
+
+    if (!g_armed)
+        return;
+
+    now = millis();
+    gap = now - g_sample_time;
+    if (gap > g_max_gap)
+        g_max_gap = gap;
+
+    if (!safety_check(now, g_sample_time, g_arm_time, &reason))
+        return;
+
+    g_armed = false;
+    /* The control loop may already have cut it, only count real trips */
+    if (digitalRead(RELAY_PIN) == HIGH)
+        return;
+    digitalWrite(RELAY_PIN, 1);
+    g_trips[reason]++;
+}
+
+void safety_setup(void)
+{
+    timer1_isr_init();
+    timer1_attachInterrupt(safety_isr);
+    timer1_enable(TIM_DIV16, TIM_EDGE, TIM_LOOP);
+    timer1_write(SAFETY_TICK * TIMER_TICKS_PER_MS);
+}
+
+void safety_arm(void)
+{
+    noInterrupts();
+    g_arm_time = millis();
+    g_sample_time = g_arm_time;
+    g_armed = true;
+    interrupts();
+}
+
+void safety_disarm(void)
+{
+    g_armed = false;
+}
+
+/* Called once control_loop() has decided on a new sample */
+void safety_sample(void)
+{
+    g_sample_time = millis();
+}
+
+bool safety_armed(void)
+{
+    return g_armed;
+}
+
+unsigned long safety_get_trips(enum safety_reason_e reason)
+{
+    return g_trips[reason];
+}
+
+unsigned long safety_get_max_gap(void)
+{
+    return g_max_gap;
+}
@@ -0,0 +1,152 @@
+#include <Arduino.h>
+
+#include "config.h"
+#include "stats.h"
+
+/*
+ * Online shot statistics. Every metric is tracked with Welford's
+ * algorithm for the all-time and per-setpoint aggregates, and with an
+ * exponentially weighted mean/variance for recent shots. The latter has
+ * alpha = 2 / (STATS_EWMA_SPAN + 1), so it follows roughly the last
+ * STATS_EWMA_SPAN shots, but every earlier shot still has a small weight.
+ * Nothing is stored per shot, so memory is fixed and adding a shot costs
+ * the same no matter how many shots have been made.
+ */
+
+struct welford {
+    unsigned long n;
+    float mean;
+    float m2;
+};
+
+struct ewma {
+    unsigned long n;
+    float mean;
+    float var;
+};
+
+struct setpoint_bin {
+    struct welford metric[STATS_NUM_METRICS];
+};
+
+static struct welford g_total[STATS_NUM_METRICS];
+static struct ewma g_recent[STATS_NUM_METRICS];
+static struct setpoint_bin g_bins[STATS_NUM_BINS];
+
+static const char *g_metric_names[STATS_NUM_METRICS] = {
+    "dose",
+    "overshoot",
+    "grind_time",
+    "flow"
+};
+
+static void welford_update(struct welford *w, float x)
+{
+    float delta = x - w->mean;
+
+    w->n++;
+    w->mean += delta / w->n;
+    w->m2 += delta * (x - w->mean);
+}
+
+static void welford_summary(const struct welford *w, struct stats_summary *s)
+{
+    s->count = w->n;
+    s->mean = w->mean;
+    s->stddev = (w->n > 1) ? sqrtf(w->m2 / (w->n - 1)) : 0.0f;
+}
+
+static void ewma_update(struct ewma *e, float x)
+{
+    const float alpha = 2.0f / (STATS_EWMA_SPAN + 1);
+    float delta, incr;
+
+    if (e->n == 0) {
+        e->mean = x;
+        e->var = 0.0f;
+    } else {
+        delta = x - e->mean;
+        incr = alpha * delta;
+        e->mean += incr;
+        e->var = (1.0f - alpha) * (e->var + delta * incr);
+    }
+    e->n++;
+}
+
+static int setpoint_to_bin(float setpoint)
+{
+    int bin = (int)lroundf((setpoint - WEIGHT_LIMIT_MIN) / STATS_BIN_WIDTH);
+
+    if (bin < 0)
+        bin = 0;
+    else if (bin >= STATS_NUM_BINS)
+        bin = STATS_NUM_BINS - 1;
+    return bin;
+}
+
+void stats_add_shot(float setpoint, float dose, float cutoff_weight,
+                    unsigned int grind_time)
+{
+    float values[STATS_NUM_METRICS];
+    struct setpoint_bin *bin = &g_bins[setpoint_to_bin(setpoint)];
+    int i;
+
+    if (grind_time == 0)
+        return;
+
+    values[STATS_DOSE] = dose;
+    values[STATS_OVERSHOOT] = dose - setpoint;
+    values[STATS_GRIND_TIME] = grind_time / 1000.0f;
+    values[STATS_FLOW] = cutoff_weight / values[STATS_GRIND_TIME];
+
+    for (i = 0; i < STATS_NUM_METRICS; ++i) {
+        welford_update(&g_total[i], values[i]);
+        ewma_update(&g_recent[i], values[i]);
+        welford_update(&bin->metric[i], values[i]);
+    }
+
+#ifdef DEBUG
+    Serial.printf("Shot: dose %.2f g, overshoot %.2f g, %.2f s, %.2f g/s\n",
+                  values[STATS_DOSE], values[STATS_OVERSHOOT],
+                  values[STATS_GRIND_TIME], values[STATS_FLOW]);
+#endif
+}
+
+void stats_reset(void)
+{
+    memset(g_total, 0, sizeof(g_total));
+    memset(g_recent, 0, sizeof(g_recent));
+    memset(g_bins, 0, sizeof(g_bins));
+}
+
+unsigned long stats_get_shot_count(void)
+{
+    return g_total[STATS_DOSE].n;
+}
+
+const char *stats_metric_name(enum stats_metric_e m)
+{
+    return g_metric_names[m];
+}
+
+void stats_get_total(enum stats_metric_e m, struct stats_summary *s)
+{
+    welford_summary(&g_total[m], s);
+}
+
+void stats_get_recent(enum stats_metric_e m, struct stats_summary *s)
+{
+    s->count = g_recent[m].n;
+    s->mean = g_recent[m].mean;
+    s->stddev = sqrtf(g_recent[m].var);
+}
+
+float stats_bin_setpoint(int bin)
+{
+    return WEIGHT_LIMIT_MIN + bin * STATS_BIN_WIDTH;
+}
+
+void stats_get_bin(int bin, enum stats_metric_e m, struct stats_summary *s)
+{
+    welford_summary(&g_bins[bin].metric[m], s);
+}
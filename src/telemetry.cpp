@@ -0,0 +1,317 @@
+#include <Arduino.h>
+
+#include "config.h"
+#include "control.h"
+#include "eeprom.h"
+#include "loadcell.h"
+#include "telemetry.h"
+
+/*
+ * Binary telemetry on the serial port ("machine mode").
+ *
+ * Every packet is <type> <payload> <crc8>, COBS encoded and terminated by
+ * a zero byte, all multi-byte values little endian. Packets are encoded
+ * straight into a TX ring buffer which is drained from the loop, only as
+ * far as the UART FIFO has room, so sending never blocks. A packet that
+ * does not fit in the ring is dropped and counted instead.
+ */
+
+#define MAX_PAYLOAD     16
+#define MAX_PACKET      (MAX_PAYLOAD + 2)
+#define MAX_ENCODED     (MAX_PACKET + MAX_PACKET / 254 + 2)
+
+static bool g_enabled = false;
+static unsigned long g_dropped = 0;
+
+static uint8_t g_tx_ring[TELEMETRY_TX_BUFFER];
+static unsigned int g_tx_head = 0;
+static unsigned int g_tx_tail = 0;
+
+static uint8_t g_rx_buf[MAX_ENCODED];
+static unsigned int g_rx_len = 0;
+static bool g_rx_overflow = false;
+
+static uint8_t crc8(const uint8_t *data, unsigned int len)
+{
+    uint8_t crc = 0;
+    unsigned int i;
+    int b;
+
+    for (i = 0; i < len; ++i) {
+        crc ^= data[i];
+        for (b = 0; b < 8; ++b)
+            crc = (crc & 0x80) ? (crc << 1) ^ 0x07 : crc << 1;
+    }
+    return crc;
+}
+
+static unsigned int tx_free(void)
+{
+    return (g_tx_tail + TELEMETRY_TX_BUFFER - g_tx_head - 1) % TELEMETRY_TX_BUFFER;
+}
+
+static void tx_put(uint8_t b)
+{
+    g_tx_ring[g_tx_head] = b;
+    g_tx_head = (g_tx_head + 1) % TELEMETRY_TX_BUFFER;
+}
+
+static void send_packet(uint8_t type, const uint8_t *payload, unsigned int len)
+{
+    uint8_t packet[MAX_PACKET];
+    unsigned int i, code_pos;
+    uint8_t code;
+
+    if (!g_enabled)
+        return;
+
+    if (tx_free() < MAX_ENCODED) {
+        g_dropped++;
+        return;
+    }
+
+    packet[0] = type;
+    memcpy(&packet[1], payload, len);
+    packet[len + 1] = crc8(packet, len + 1);
+    len += 2;
+
+    /* COBS encode into the ring, patching in each block's code byte */
+    code_pos = g_tx_head;
+    tx_put(0);
+    code = 1;
+    for (i = 0; i < len; ++i) {
+        if (packet[i] == 0) {
+            g_tx_ring[code_pos] = code;
+            code_pos = g_tx_head;
+            tx_put(0);
+            code = 1;
+        } else {
+            tx_put(packet[i]);
+            if (++code == 0xFF) {
+                g_tx_ring[code_pos] = code;
+                code_pos = g_tx_head;
+                tx_put(0);
+                code = 1;
+            }
+        }
+    }
+    g_tx_ring[code_pos] = code;
+    tx_put(0);
+}
+
+static unsigned int put_u32(uint8_t *p, uint32_t v)
+{
+    p[0] = v;
+    p[1] = v >> 8;
+    p[2] = v >> 16;
+    p[3] = v >> 24;
+    return 4;
+}
+
+static unsigned int put_float(uint8_t *p, float f)
+{
+    uint32_t v;
+
+    memcpy(&v, &f, sizeof(v));
+    return put_u32(p, v);
+}
+
+static float get_float(const uint8_t *p)
+{
+    uint32_t v = p[0] | (p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+    float f;
+
+    memcpy(&f, &v, sizeof(f));
+    return f;
+}
+
+void telemetry_send_sample(uint32_t seq, unsigned long time, float weight)
+{
+    uint8_t payload[MAX_PAYLOAD];
+    unsigned int len = 0;
+
+    len += put_u32(&payload[len], seq);
+    len += put_u32(&payload[len], time);
+    len += put_float(&payload[len], weight);
+    payload[len++] = control_get_relay();
+    send_packet(TELEMETRY_PKT_SAMPLE, payload, len);
+}
+
+void telemetry_send_event(enum telemetry_event_e event, float value)
+{
+    uint8_t payload[MAX_PAYLOAD];
+    unsigned int len = 0;
+
+    len += put_u32(&payload[len], millis());
+    payload[len++] = event;
+    len += put_float(&payload[len], value);
+    send_packet(TELEMETRY_PKT_EVENT, payload, len);
+}
+
+static void send_status(void)
+{
+    uint8_t payload[MAX_PAYLOAD];
+    unsigned int len = 0;
+
+    len += put_u32(&payload[len], g_dropped);
+    len += put_float(&payload[len], eeprom_setpoint_get());
+    len += put_float(&payload[len], eeprom_calfactor_get());
+    len += put_float(&payload[len], eeprom_timer_threshold_get());
+    send_packet(TELEMETRY_PKT_STATUS, payload, len);
+}
+
+static void send_ack(uint8_t cmd, bool ok)
+{
+    uint8_t payload[2] = { cmd, ok };
+
+    send_packet(TELEMETRY_PKT_ACK, payload, sizeof(payload));
+}
+
+static void handle_command(const uint8_t *packet, unsigned int len)
+{
+    bool ok = true;
+
+    switch (packet[0]) {
+    case TELEMETRY_CMD_TARE:
+        loadcell_tare();
+        break;
+
+    case TELEMETRY_CMD_SETPOINT:
+        if (len != 5)
+            ok = false;
+        else {
+            eeprom_setpoint_set(get_float(&packet[1]));
+            ok = (eeprom_setpoint_get() == get_float(&packet[1]));
+        }
+        break;
+
+    case TELEMETRY_CMD_RESET_RELAY:
+        control_reset_relay();
+        break;
+
+    case TELEMETRY_CMD_SET_RELAY:
+        control_set_relay();
+        break;
+
+    case TELEMETRY_CMD_STATUS:
+        send_status();
+        break;
+
+    case TELEMETRY_CMD_EXIT:
+        send_ack(packet[0], true);
+        telemetry_enable(false);
+        return;
+
+    default:
+        ok = false;
+        break;
+    }
+    send_ack(packet[0], ok);
+}
+
+static void handle_frame(void)
+{
+    uint8_t packet[MAX_ENCODED];
+    unsigned int i = 0, len = 0;
+    uint8_t code, j;
+
+    /* COBS decode */
+    while (i < g_rx_len) {
+        code = g_rx_buf[i++];
+        if (code == 0)
+            return;
+        for (j = 1; j < code; ++j) {
+            if (i >= g_rx_len)
+                return;
+            packet[len++] = g_rx_buf[i++];
+        }
+        if (code != 0xFF && i < g_rx_len)
+            packet[len++] = 0;
+    }
+
+    if (len < 2 || crc8(packet, len - 1) != packet[len - 1])
+        return;
+    handle_command(packet, len - 1);
+}
+
+static void telemetry_receive(void)
+{
+    while (Serial.available() > 0) {
+        uint8_t b = Serial.read();
+
+        if (b == 0) {
+            if (!g_rx_overflow && g_rx_len > 0)
+                handle_frame();
+            g_rx_len = 0;
+            g_rx_overflow = false;
+            if (!g_enabled)
+                return;
+        } else if (g_rx_len < sizeof(g_rx_buf)) {
+            g_rx_buf[g_rx_len++] = b;
+        } else {
+            g_rx_overflow = true;
+        }
+    }
+}
+
+static void telemetry_transmit(void)
+{
+    int room = Serial.availableForWrite();
+    unsigned int n;
+
+    while (room > 0 && g_tx_tail != g_tx_head) {
+        if (g_tx_head > g_tx_tail)
+            n = g_tx_head - g_tx_tail;
+        else
+            n = TELEMETRY_TX_BUFFER - g_tx_tail;
+        if (n > (unsigned int)room)
+            n = room;
+        Serial.write(&g_tx_ring[g_tx_tail], n);
+        g_tx_tail = (g_tx_tail + n) % TELEMETRY_TX_BUFFER;
+        room -= n;
+    }
+}
+
+void telemetry_loop(void)
+{
+    if (!g_enabled)
+        return;
+
+    telemetry_receive();
+    telemetry_transmit();
+}
+
+void telemetry_enable(bool enable)
+{
+    if (enable == g_enabled)
+        return;
+
+    if (enable) {
+        Serial.println("Switching to binary telemetry at " +
+                       String(TELEMETRY_BAUD) + " baud");
+    } else {
+        /* Let the final acknowledgement go out before switching back */
+        while (g_tx_tail != g_tx_head)
+            telemetry_transmit();
+    }
+    Serial.flush();
+
+    g_enabled = enable;
+    g_tx_head = g_tx_tail = 0;
+    g_rx_len = 0;
+    g_rx_overflow = false;
+    Serial.begin(enable ? TELEMETRY_BAUD : SERIAL_BAUD);
+
+    if (!enable)
+        Serial.println("Binary telemetry disabled");
+}
+
+bool telemetry_enabled(void)
+{
+    return g_enabled;
+}
+
+unsigned long telemetry_get_dropped(void)
+{
+    return g_dropped;
+}
@@ -0,0 +1,149 @@
+#include <Arduino.h>
+
+#include "config.h"
+#include "trace.h"
+
+#ifdef TRACE_ENABLE
+
+/*
+ * The ring keeps recording until a trigger, then records another
+ * TRACE_POST_TRIGGER events and freezes, so the buffer holds what led up
+ * to the trigger and a little of what followed. It stays frozen until
+ * re-armed.
+ *
+ * Download format, little endian:
+ *   "STRC" magic, u8 version, u8 CPU MHz, u16 event count,
+ *   then per event: u32 cycle count, u8 id, u8 type, u16 reserved
+ */
+
+#define TRACE_MAGIC     0x43525453  /* "STRC" */
+#define TRACE_VERSION   1
+#define HEADER_SIZE     8
+
+struct trace_event {
+    uint32_t cycles;
+    uint8_t id;
+    uint8_t type;
+    uint16_t reserved;
+};
+
+static struct trace_event g_ring[TRACE_BUFFER_SIZE];
+static volatile uint16_t g_head = 0;
+static volatile uint16_t g_count = 0;
+static volatile uint16_t g_remaining = 0;
+static volatile bool g_triggered = false;
+static volatile bool g_frozen = false;
+
+static inline ICACHE_RAM_ATTR void trace_put(uint32_t cycles, uint8_t id, uint8_t type)
+{
+    struct trace_event *e;
+
+    if (g_frozen)
+        return;
+
+    e = &g_ring[g_head];
+    e->cycles = cycles;
+    e->id = id;
+    e->type = type;
+    g_head = (g_head + 1) % TRACE_BUFFER_SIZE;
+    if (g_count < TRACE_BUFFER_SIZE)
+        g_count++;
+
+    if (g_triggered && --g_remaining == 0)
+        g_frozen = true;
+}
+
+ICACHE_RAM_ATTR void trace_record(uint8_t id, uint8_t type)
+{
+    /* Called from the ISR too, so mask interrupts rather than enable them */
+    uint32_t ps = xt_rsil(15);
+
+    trace_put(ESP.getCycleCount(), id, type);
+    xt_wsr_ps(ps);
+}
+
+void trace_span(uint32_t start, uint8_t id)
+{
+    uint32_t now = ESP.getCycleCount();
+    uint32_t ps;
+
+    if (now - start < TRACE_MIN_SPAN_CYCLES)
+        return;
+
+    ps = xt_rsil(15);
+    trace_put(start, id, TRACE_TYPE_BEGIN);
+    trace_put(now, id, TRACE_TYPE_END);
+    xt_wsr_ps(ps);
+}
+
+void trace_trigger(void)
+{
+    uint32_t ps;
+
+    if (g_triggered)
+        return;
+
+    trace_record(TRACE_TRIGGER, TRACE_TYPE_INSTANT);
+    ps = xt_rsil(15);
+    g_remaining = TRACE_POST_TRIGGER;
+    g_triggered = true;
+    xt_wsr_ps(ps);
+}
+
+void trace_freeze(void)
+{
+    g_frozen = true;
+}
+
+void trace_arm(void)
+{
+    uint32_t ps = xt_rsil(15);
+
+    g_head = 0;
+    g_count = 0;
+    g_triggered = false;
+    g_frozen = false;
+    xt_wsr_ps(ps);
+}
+
+bool trace_frozen(void)
+{
+    return g_frozen;
+}
+
+size_t trace_size(void)
+{
+    return HEADER_SIZE + g_count * sizeof(struct trace_event);
+}
+
+/* Copy out bytes [index, index + len) of the download, ring must be frozen */
+size_t trace_read(uint8_t *buf, size_t len, size_t index)
+{
+    uint8_t header[HEADER_SIZE];
+    uint32_t magic = TRACE_MAGIC;
+    uint16_t count = g_count;
+    uint16_t oldest = (g_head + TRACE_BUFFER_SIZE - count) % TRACE_BUFFER_SIZE;
+    size_t total = trace_size();
+    size_t n = 0;
+
+    memcpy(&header[0], &magic, 4);
+    header[4] = TRACE_VERSION;
+    header[5] = ESP.getCpuFreqMHz();
+    memcpy(&header[6], &count, 2);
+
+    while (n < len && index < total) {
+        if (index < HEADER_SIZE) {
+            buf[n] = header[index];
+        } else {
+            size_t offset = index - HEADER_SIZE;
+            size_t slot = (oldest + offset / sizeof(struct trace_event)) % TRACE_BUFFER_SIZE;
+
+            buf[n] = ((const uint8_t *)&g_ring[slot])[offset % sizeof(struct trace_event)];
+        }
+        n++;
+        index++;
+    }
+    return n;
+}
+
+#endif
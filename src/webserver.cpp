@@ -18,9 +18,15 @@
 #include "loadcell.h"
 #include "control.h"
 #include "eeprom.h"
+#include "stats.h"
+#include "trace.h"
+#include "safety.h"
+#include "archive.h"
+#include "container.h"
 #include "config.h"
 
 static AsyncWebServer server(HTTP_PORT);
+static AsyncEventSource events("/events");
 
 String processor(const String& var)
 {
@@ -46,26 +52,64 @@ static void get_stylesheet(AsyncWebServerRequest *request)
     request->send(LittleFS, "/ss.css", "text/css");
 }
 
+/* Sequence number and acquisition time, for clients to check freshness */
+static void append_stamp(String &value, const struct loadcell_sample *s)
+{
+    value += ";";
+    value += String(s->seq);
+    value += ";";
+    value += String(s->time);
+}
+
+/* Bare weight for existing consumers, /get_data carries the stamp */
 static void get_weight(AsyncWebServerRequest *request)
 {
     String value;
-    value = String(loadcell_get_weight());
+    TRACE_BEGIN(TRACE_HTTP);
+    value = String(loadcell_get_display_weight());
     request->send(200, "text/plain", value);
+    TRACE_END(TRACE_HTTP);
 }
 
-static void get_data(AsyncWebServerRequest *request)
+/* The /get_data record, also pushed to /events subscribers */
+static String data_string(const struct loadcell_sample *s)
 {
     String value;
-    value = String(loadcell_get_weight(), 1);
+
+    value = String(s->weight, 1);
     if (control_get_relay())
         value += ";1;";
     else
         value += ";0;";
     value += String(control_get_elapsed_time());
+    value += ";";
+    value += String(container_get_active());
+    value += ";";
+    value += String(container_get_weight(container_get_active()), 1);
+    value += ";";
+    value += String(container_get_matches());
+    append_stamp(value, s);
+    return value;
+}
+
+static void get_data(AsyncWebServerRequest *request)
+{
+    struct loadcell_sample s;
+    String value;
+    TRACE_BEGIN(TRACE_HTTP);
+    loadcell_get_display_sample(&s);
+    value = data_string(&s);
 #ifdef DEBUG
     Serial.println("Get data: " + value);
 #endif
     request->send(200, "text/plain", value);
+    TRACE_END(TRACE_HTTP);
+}
+
+/* Device clock in ms, for clients to estimate their offset to it */
+static void get_time(AsyncWebServerRequest *request)
+{
+    request->send(200, "text/plain", String(millis()));
 }
 
 static void tare(AsyncWebServerRequest *request)
@@ -76,8 +120,10 @@ static void tare(AsyncWebServerRequest *request)
 
 static void tare_status(AsyncWebServerRequest *request)
 {
+    TRACE_BEGIN(TRACE_HTTP);
     String message = loadcell_tare_status() ? "Done" : "Taring...";
     request->send(200, "text/plain", message);
+    TRACE_END(TRACE_HTTP);
 }
 
 static void reset_relay(AsyncWebServerRequest *request)
@@ -114,6 +160,229 @@ static void set_weight_setpoint(AsyncWebServerRequest *request)
     request->send(200, "text/plain", "");
 }
 
+static void append_summary(String &json, const char *name,
+                           const struct stats_summary *s)
+{
+    json += "\"";
+    json += name;
+    json += "\":{\"n\":";
+    json += String(s->count);
+    json += ",\"mean\":";
+    json += String(s->mean, 2);
+    json += ",\"sd\":";
+    json += String(s->stddev, 2);
+    json += "}";
+}
+
+static void append_metrics(String &json, int bin, bool recent)
+{
+    struct stats_summary s;
+    int i;
+
+    json += "{";
+    for (i = 0; i < STATS_NUM_METRICS; ++i) {
+        enum stats_metric_e m = (enum stats_metric_e)i;
+
+        if (bin >= 0)
+            stats_get_bin(bin, m, &s);
+        else if (recent)
+            stats_get_recent(m, &s);
+        else
+            stats_get_total(m, &s);
+
+        if (i > 0)
+            json += ",";
+        append_summary(json, stats_metric_name(m), &s);
+    }
+    json += "}";
+}
+
+static void get_stats(AsyncWebServerRequest *request)
+{
+    String json;
+    struct stats_summary s;
+    bool first = true;
+    int bin;
+
+    TRACE_BEGIN(TRACE_HTTP);
+    if (request->hasParam("reset"))
+        stats_reset();
+
+    json = "{\"shots\":";
+    json += String(stats_get_shot_count());
+    json += ",\"ewma_span\":";
+    json += String(STATS_EWMA_SPAN);
+    /* Shots with an archived curve, so pages don't need to scan /curves */
+    json += ",\"first_shot\":";
+    json += String(archive_first_shot());
+    json += ",\"last_shot\":";
+    json += String(archive_last_shot());
+    json += ",\"total\":";
+    append_metrics(json, -1, false);
+    json += ",\"recent\":";
+    append_metrics(json, -1, true);
+    json += ",\"setpoints\":[";
+    for (bin = 0; bin < STATS_NUM_BINS; ++bin) {
+        stats_get_bin(bin, STATS_DOSE, &s);
+        if (s.count == 0)
+            continue;
+        if (!first)
+            json += ",";
+        first = false;
+        json += "{\"setpoint\":";
+        json += String(stats_bin_setpoint(bin), 1);
+        json += ",\"metrics\":";
+        append_metrics(json, bin, false);
+        json += "}";
+    }
+    json += "]}";
+
+    request->send(200, "application/json", json);
+    TRACE_END(TRACE_HTTP);
+}
+
+static void get_perf(AsyncWebServerRequest *request)
+{
+    String value;
+
+    TRACE_BEGIN(TRACE_HTTP);
+    value = String(ESP.getFreeHeap());
+    value += ";";
+    value += String(control_get_max_latency());
+    value += ";";
+    value += String(control_get_max_loop_time());
+    value += ";";
+    value += String(loadcell_get_sample_interval(), 1);
+    value += ";";
+    value += String(loadcell_get_decision_delay(), 1);
+    value += ";";
+    value += String(loadcell_get_display_delay(), 1);
+    if (request->hasParam("reset"))
+        control_reset_perf();
+    request->send(200, "text/plain", value);
+    TRACE_END(TRACE_HTTP);
+}
+
+static void get_safety(AsyncWebServerRequest *request)
+{
+    String value;
+    int i;
+
+    for (i = 0; i < SAFETY_NUM_REASONS; ++i) {
+        value += String(safety_get_trips((enum safety_reason_e)i));
+        value += ";";
+    }
+    value += String(safety_get_max_gap());
+    value += safety_armed() ? ";1" : ";0";
+    request->send(200, "text/plain", value);
+}
+
+static void append_point(void *ctx, const struct archive_point *p)
+{
+    String *json = (String *)ctx;
+
+    if (json->endsWith("]"))
+        *json += ",";
+    *json += "[";
+    *json += String(p->t);
+    *json += ",";
+    *json += String(p->min, 2);
+    *json += ",";
+    *json += String(p->max, 2);
+    *json += ",";
+    *json += String(p->mean, 2);
+    *json += "]";
+}
+
+static unsigned long get_param(AsyncWebServerRequest *request, const char *name,
+                               unsigned long def)
+{
+    if (!request->hasParam(name))
+        return def;
+    return strtoul(request->getParam(name)->value().c_str(), NULL, 10);
+}
+
+/*
+ * /curves                          overview of all shots (dose per point)
+ * /curves?from=&to=                overview of a range of shot ids
+ * /curves?shot=N[&from=&to=]       one shot, optionally a time range in ms
+ * Every form takes points=, the max number of [t, min, max, mean] points.
+ */
+static void get_curves(AsyncWebServerRequest *request)
+{
+    static const char *levels[] = { "raw", "buckets", "shots" };
+    unsigned long points = get_param(request, "points", 100);
+    String json;
+    int level;
+
+    if (points > ARCHIVE_MAX_POINTS)
+        points = ARCHIVE_MAX_POINTS;
+
+    json = "{\"first\":";
+    json += String(archive_first_shot());
+    json += ",\"last\":";
+    json += String(archive_last_shot());
+    if (request->hasParam("shot")) {
+        json += ",\"shot\":";
+        json += String(get_param(request, "shot", 0));
+    }
+    json += ",\"points\":[";
+    json.reserve(json.length() + points * 32);
+
+    if (request->hasParam("shot")) {
+        level = archive_query_shot(get_param(request, "shot", 0),
+                                   get_param(request, "from", 0),
+                                   get_param(request, "to", 0xFFFFFFFF),
+                                   points, append_point, &json);
+    } else {
+        level = archive_query_overview(get_param(request, "from", 0),
+                                       get_param(request, "to", 0xFFFFFFFF),
+                                       points, append_point, &json);
+    }
+
+    if (level < 0) {
+        request->send(404, "text/plain", "No such curve");
+        return;
+    }
+
+    json += "],\"level\":\"";
+    json += levels[level];
+    json += "\"}";
+    request->send(200, "application/json", json);
+}
+
+static void get_trace(AsyncWebServerRequest *request)
+{
+#ifdef TRACE_ENABLE
+    AsyncWebServerResponse *response;
+
+    if (request->hasParam("arm")) {
+        trace_arm();
+        request->send(200, "text/plain", "Armed");
+        return;
+    }
+
+    /* Freeze the ring so it can't change while it is being sent */
+    trace_freeze();
+
+    response = request->beginResponse("application/octet-stream", trace_size(),
+        [](uint8_t *buf, size_t len, size_t index) -> size_t {
+            return trace_read(buf, len, index);
+        });
+    response->addHeader("Content-Disposition", "attachment; filename=trace.bin");
+    request->send(response);
+#else
+    request->send(501, "text/plain", "Tracing not enabled, build with -DTRACE_ENABLE");
+#endif
+}
+
+static void events_connect(AsyncEventSourceClient *client)
+{
+    /* The new client is already counted */
+    if (events.count() > EVENTS_MAX_CLIENTS)
+        client->close();
+}
+
 void webserver_setup()
 {
     WiFiManager wifi;
@@ -141,6 +410,21 @@ void webserver_setup()
     server.on("/tare_status", HTTP_GET, tare_status);
     server.on("/reset_relay", HTTP_GET, reset_relay);
     server.on("/set_weight_setpoint", HTTP_GET, set_weight_setpoint);
+    server.on("/stats", HTTP_GET, get_stats);
+    server.on("/perf", HTTP_GET, get_perf);
+    server.on("/trace", HTTP_GET, get_trace);
+    server.on("/safety", HTTP_GET, get_safety);
+    server.on("/curves", HTTP_GET, get_curves);
+    server.on("/time", HTTP_GET, get_time);
+
+    /*
+     * Server-sent events with the /get_data record, for dashboards that
+     * would otherwise poll. Every message is queued and written once per
+     * subscriber, so the number of subscribers is capped. Many viewers
+     * should go through an aggregator such as tools/fleet.py.
+     */
+    events.onConnect(events_connect);
+    server.addHandler(&events);
 
     // Not found error
     server.onNotFound(not_found);
@@ -148,3 +432,20 @@ void webserver_setup()
     server.begin();
 }
 
+void webserver_loop(void)
+{
+    static uint32_t last_seq = 0;
+    static unsigned long last_send = 0;
+    struct loadcell_sample s;
+
+    if (events.count() == 0 || millis() - last_send < EVENTS_INTERVAL)
+        return;
+
+    loadcell_get_display_sample(&s);
+    if (s.seq == last_seq)
+        return;
+
+    last_seq = s.seq;
+    last_send = millis();
+    events.send(data_string(&s).c_str(), "data", s.seq);
+}
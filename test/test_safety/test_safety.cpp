@@ -0,0 +1,121 @@
+#include <stdint.h>
+#include <unity.h>
+
+#include "config.h"
+#include "safety_check.h"
+
+/*
+ * Drives safety_check() the way the timer interrupt does, once every
+ * SAFETY_TICK ms, while samples arrive every interval ms. No samples are
+ * delivered from stall ms after arming for stall_len ms, which stands in
+ * for loop() being blocked. Times are relative to base so that the 32 bit
+ * millis() wrapping around can be tested too.
+ */
+struct run_result {
+    bool tripped;
+    enum safety_reason_e reason;
+    uint32_t trip;          /* Trip time, relative to base */
+    uint32_t last_sample;   /* Latest sample seen at the trip */
+};
+
+static struct run_result run(uint32_t base, uint32_t interval,
+                             uint32_t stall, uint32_t stall_len,
+                             uint32_t duration)
+{
+    struct run_result r = { false, SAFETY_NUM_REASONS, 0, 0 };
+    uint32_t next_sample = interval;
+    uint32_t t;
+
+    for (t = 0; t <= duration; t += SAFETY_TICK) {
+        while (next_sample <= t) {
+            if (next_sample < stall || next_sample >= stall + stall_len)
+                r.last_sample = next_sample;
+            next_sample += interval;
+        }
+        if (safety_check(base + t, base + r.last_sample, base, &r.reason)) {
+            r.tripped = true;
+            r.trip = t;
+            break;
+        }
+    }
+    return r;
+}
+
+static void test_regular_samples_do_not_trip(void)
+{
+    struct run_result r;
+
+    r = run(1000, 12, UINT32_MAX, 0, SAFETY_MAX_ON_TIME - 1);
+    TEST_ASSERT_FALSE(r.tripped);
+
+    /* Gaps right at the deadline are still fine */
+    r = run(1000, SAFETY_SAMPLE_DEADLINE, UINT32_MAX, 0, SAFETY_MAX_ON_TIME - 1);
+    TEST_ASSERT_FALSE(r.tripped);
+}
+
+static void test_short_stall_does_not_trip(void)
+{
+    struct run_result r;
+
+    /* Samples every 12 ms, gap between two of them just below the deadline */
+    r = run(1000, 12, 2000, SAFETY_SAMPLE_DEADLINE - 24, SAFETY_MAX_ON_TIME - 1);
+    TEST_ASSERT_FALSE(r.tripped);
+}
+
+static void test_stall_trips_within_deadline(void)
+{
+    const uint32_t intervals[] = { 1, 12, 100, SAFETY_SAMPLE_DEADLINE };
+    unsigned int i;
+    uint32_t stall;
+    struct run_result r;
+
+    for (i = 0; i < sizeof(intervals) / sizeof(intervals[0]); i++) {
+        for (stall = 1000; stall < 1000 + intervals[i] + SAFETY_TICK; stall++) {
+            r = run(1000, intervals[i], stall, UINT32_MAX / 2,
+                    SAFETY_MAX_ON_TIME - 1);
+            TEST_ASSERT_TRUE(r.tripped);
+            TEST_ASSERT_EQUAL(SAFETY_TRIP_STALE_SAMPLE, r.reason);
+            TEST_ASSERT_GREATER_THAN(SAFETY_SAMPLE_DEADLINE,
+                                     r.trip - r.last_sample);
+            TEST_ASSERT_LESS_OR_EQUAL(SAFETY_SAMPLE_DEADLINE + SAFETY_TICK,
+                                      r.trip - r.last_sample);
+        }
+    }
+}
+
+static void test_stall_trips_across_millis_wrap(void)
+{
+    struct run_result r;
+
+    r = run(UINT32_MAX - 500, 12, 400, UINT32_MAX / 2, SAFETY_MAX_ON_TIME - 1);
+    TEST_ASSERT_TRUE(r.tripped);
+    TEST_ASSERT_EQUAL(SAFETY_TRIP_STALE_SAMPLE, r.reason);
+    TEST_ASSERT_LESS_OR_EQUAL(SAFETY_SAMPLE_DEADLINE + SAFETY_TICK,
+                              r.trip - r.last_sample);
+}
+
+static void test_max_on_time_trips(void)
+{
+    struct run_result r;
+
+    r = run(1000, 12, UINT32_MAX, 0, 2 * SAFETY_MAX_ON_TIME);
+    TEST_ASSERT_TRUE(r.tripped);
+    TEST_ASSERT_EQUAL(SAFETY_TRIP_MAX_ON_TIME, r.reason);
+    TEST_ASSERT_EQUAL(SAFETY_MAX_ON_TIME, r.trip);
+
+    r = run(UINT32_MAX - 500, 12, UINT32_MAX, 0, 2 * SAFETY_MAX_ON_TIME);
+    TEST_ASSERT_TRUE(r.tripped);
+    TEST_ASSERT_EQUAL(SAFETY_TRIP_MAX_ON_TIME, r.reason);
+    TEST_ASSERT_EQUAL(SAFETY_MAX_ON_TIME, r.trip);
+}
+
+int main(void)
+{
+    UNITY_BEGIN();
+    RUN_TEST(test_regular_samples_do_not_trip);
+    RUN_TEST(test_short_stall_does_not_trip);
+    RUN_TEST(test_stall_trips_within_deadline);
+    RUN_TEST(test_stall_trips_across_millis_wrap);
+    RUN_TEST(test_max_on_time_trips);
+    return UNITY_END();
+}
@@ -0,0 +1,244 @@
+#!/usr/bin/env python3
+"""Local stand-in for the SmartScale HTTP API.
+
+Serves the same routes as webserver_setup() from a single-threaded
+asyncio loop, which also runs a simulated sample/control loop. As on the
+ESP8266, every request handled delays the next control decision, so the
+worst-case decision latency reported by /perf reflects the request load.
+With --name and the zeroconf package installed the server is announced
+over mDNS like the firmware does, for trying out fleet.py.
+
+    ./fake_scale.py --port 8080
+"""
+
+import argparse
+import asyncio
+import random
+import socket
+import time
+
+SPS = 80.0
+SETPOINT_MIN = 5.0
+SETPOINT_MAX = 30.0
+EVENTS_INTERVAL = 0.1
+EVENTS_MAX_CLIENTS = 2
+FIRMWARE_VERSION = "1.0.0"
+API_CAPABILITIES = ("get_data,weight,tare,tare_status,toggle_relay,reset_relay,"
+                    "set_weight_setpoint,stats,perf,trace,safety,curves,time,events")
+
+
+class Scale:
+    def __init__(self, handler_cost):
+        self.handler_cost = handler_cost
+        self.setpoint = 18.0
+        self.threshold = 0.5
+        self.weight = 0.0
+        self.relay = False
+        self.sample_time = time.monotonic()
+        self.seq = 0
+        self.boot = time.monotonic()
+        self.timer_start = None
+        self.timer_stop = None
+        self.tare_until = 0.0
+        self.max_latency = 0.0
+        self.max_loop_time = 0.0
+        self.flow = 0.0
+        self.subscribers = 0
+
+    def elapsed_ms(self):
+        if self.timer_start is None:
+            return 0
+        end = self.timer_stop if self.timer_stop is not None else time.monotonic()
+        return int((end - self.timer_start) * 1000)
+
+    def control(self):
+        now = time.monotonic()
+        self.max_latency = max(self.max_latency, now - self.sample_time)
+        if self.weight >= self.setpoint:
+            self.relay = True
+        if self.timer_start is None and self.weight >= self.threshold:
+            self.timer_start = now
+        elif self.timer_start is not None and self.timer_stop is None \
+                and self.weight >= self.setpoint:
+            self.timer_stop = now
+        elif self.weight <= self.threshold:
+            self.timer_start = self.timer_stop = None
+
+    async def sample_loop(self):
+        period = 1.0 / SPS
+        next_sample = time.monotonic()
+        last = next_sample
+        while True:
+            next_sample += period
+            await asyncio.sleep(max(0.0, next_sample - time.monotonic()))
+            self.sample_time = time.monotonic()
+            self.seq += 1
+            self.max_loop_time = max(self.max_loop_time, self.sample_time - last)
+            last = self.sample_time
+            # Grind a dose at ~1.5 g/s, then empty the cup and start over
+            if not self.relay:
+                self.flow = 1.5
+            elif self.flow > 0:
+                self.flow = 0
+            self.weight += self.flow * period + random.gauss(0, 0.02)
+            if self.relay and self.timer_stop is not None and \
+                    self.sample_time - self.timer_stop > 2.0:
+                self.weight = 0.0
+                self.relay = False
+            # Yield so queued requests run before the decision, as loop() would
+            await asyncio.sleep(0)
+            self.control()
+
+    def millis(self, t=None):
+        return int(((t if t is not None else time.monotonic()) - self.boot) * 1000)
+
+    def stamp(self):
+        return ";%d;%d" % (self.seq, self.millis(self.sample_time))
+
+    def data(self):
+        return "%.1f;%d;%d;-1;0.0;0" % (self.weight, self.relay,
+                                        self.elapsed_ms()) + self.stamp()
+
+    def route(self, path, query):
+        if path == "/get_data":
+            return self.data()
+        if path == "/weight":
+            return "%.2f" % self.weight
+        if path == "/time":
+            return "%d" % self.millis()
+        if path == "/tare":
+            self.weight = 0.0
+            self.tare_until = time.monotonic() + 0.3
+            return "Taring..."
+        if path == "/tare_status":
+            return "Done" if time.monotonic() >= self.tare_until else "Taring..."
+        if path == "/reset_relay":
+            self.relay = False
+            return ""
+        if path == "/toggle_relay":
+            self.relay = not self.relay
+            return ""
+        if path == "/set_weight_setpoint":
+            try:
+                value = float(query.get("value", "nan"))
+            except ValueError:
+                value = float("nan")
+            if SETPOINT_MIN <= value <= SETPOINT_MAX:
+                self.setpoint = value
+            return ""
+        if path == "/perf":
+            # Free heap is not simulated, filter delays are the defaults
+            interval = 1000.0 / SPS
+            value = "%d;%d;%d;%.1f;%.1f;%.1f" % (
+                0, self.max_latency * 1e6, self.max_loop_time * 1e6,
+                interval, interval, interval * 10)
+            if "reset" in query:
+                self.max_latency = self.max_loop_time = 0.0
+            return value
+        return None
+
+    async def handle(self, reader, writer):
+        try:
+            line = (await reader.readline()).decode("latin-1")
+            while (await reader.readline()) not in (b"\r\n", b"\n", b""):
+                pass
+            parts = line.split()
+            target = parts[1] if len(parts) > 1 else "/"
+            path, _, qs = target.partition("?")
+            query = dict(p.partition("=")[::2] for p in qs.split("&") if p)
+            if path == "/events":
+                await self.events(writer)
+                return
+            # Block the loop like a synchronous handler on the device would
+            if self.handler_cost:
+                end = time.perf_counter() + self.handler_cost
+                while time.perf_counter() < end:
+                    pass
+            body = self.route(path, query)
+            status = "200 OK" if body is not None else "404 Not Found"
+            body = (body if body is not None else "Not found").encode()
+            writer.write(b"HTTP/1.1 " + status.encode() +
+                         b"\r\nContent-Type: text/plain\r\nContent-Length: " +
+                         str(len(body)).encode() +
+                         b"\r\nConnection: close\r\n\r\n" + body)
+            await writer.drain()
+        except ConnectionError:
+            pass
+        finally:
+            writer.close()
+
+    async def events(self, writer):
+        """Push the /get_data record as it changes, like webserver_loop()."""
+        if self.subscribers >= EVENTS_MAX_CLIENTS:
+            # The device accepts the stream and closes it right away
+            writer.write(b"HTTP/1.1 200 OK\r\nContent-Type: text/event-stream\r\n"
+                         b"Cache-Control: no-cache\r\nConnection: keep-alive\r\n\r\n")
+            await writer.drain()
+            return
+        self.subscribers += 1
+        try:
+            await self.stream(writer)
+        finally:
+            self.subscribers -= 1
+
+    async def stream(self, writer):
+        writer.write(b"HTTP/1.1 200 OK\r\nContent-Type: text/event-stream\r\n"
+                     b"Cache-Control: no-cache\r\nConnection: keep-alive\r\n\r\n"
+                     b"retry: 1000\n\n")
+        last_seq = None
+        while True:
+            await writer.drain()
+            await asyncio.sleep(EVENTS_INTERVAL)
+            if self.seq == last_seq:
+                continue
+            last_seq = self.seq
+            writer.write(("id: %d\nevent: data\ndata: %s\n\n" %
+                          (self.seq, self.data())).encode())
+
+
+def announce(name, port):
+    """Register an _http._tcp service with the firmware's TXT records."""
+    try:
+        from zeroconf import ServiceInfo, Zeroconf
+    except ImportError:
+        print("zeroconf not installed, not announcing over mDNS")
+        return None
+    zc = Zeroconf()
+    addr = socket.gethostbyname(socket.gethostname())
+    info = ServiceInfo("_http._tcp.local.", "%s._http._tcp.local." % name,
+                       addresses=[socket.inet_aton(addr)], port=port,
+                       properties={"fw": FIRMWARE_VERSION,
+                                   "api": API_CAPABILITIES,
+                                   "stream": "/events"},
+                       server="%s.local." % name)
+    zc.register_service(info)
+    return zc
+
+
+async def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("--host", default="127.0.0.1")
+    parser.add_argument("--port", type=int, default=8080)
+    parser.add_argument("--handler-cost", type=float, default=0.0005,
+                        help="CPU seconds burnt per request (default 0.5 ms)")
+    parser.add_argument("--name",
+                        help="announce over mDNS under this instance name")
+    args = parser.parse_args()
+
+    scale = Scale(args.handler_cost)
+    server = await asyncio.start_server(scale.handle, args.host, args.port)
+    print("Fake SmartScale on http://%s:%d" % (args.host, args.port))
+    zc = announce(args.name, args.port) if args.name else None
+    try:
+        await asyncio.gather(server.serve_forever(), scale.sample_loop())
+    finally:
+        if zc:
+            zc.unregister_all_services()
+            zc.close()
+
+
+if __name__ == "__main__":
+    try:
+        asyncio.run(main())
+    except KeyboardInterrupt:
+        pass
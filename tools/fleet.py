@@ -0,0 +1,330 @@
+#!/usr/bin/env python3
+"""Discover SmartScales on the network and serve a combined dashboard.
+
+Each scale gets exactly one /events subscription from this process, falling
+back to polling /get_data for firmware without it, or while all of the
+scale's /events slots are taken. Browsers and scripts talk
+to the aggregator instead of the scales, so the load on a scale does not
+depend on how many people are watching.
+
+Scales are found over mDNS when the zeroconf package is installed, or can
+be listed with --device.
+
+    ./fleet.py --listen :8000
+    ./fleet.py --no-discover --device 127.0.0.1:8080 --device 127.0.0.1:8081
+"""
+
+import argparse
+import http.client
+import json
+import socket
+import threading
+import time
+from http.server import BaseHTTPRequestHandler, ThreadingHTTPServer
+
+SERVICE_TYPE = "_http._tcp.local."
+NAME_PREFIX = "SmartScale"
+FIELDS = ("weight", "relay", "elapsed", "container", "cweight", "matches",
+          "seq", "acq_ms")
+POLL_INTERVAL = 0.25
+EVENTS_RETRY = 30.0
+RETRY_INTERVAL = 2.0
+TIMEOUT = 5.0
+
+
+def parse_data(text):
+    """Split a /get_data record into a dict, missing fields are left out."""
+    record = {}
+    for key, value in zip(FIELDS, text.strip().split(";")):
+        try:
+            record[key] = float(value) if key in ("weight", "cweight") \
+                else int(value)
+        except ValueError:
+            pass
+    return record
+
+
+class Device:
+    """One scale and the single connection used to follow it."""
+
+    def __init__(self, name, host, port, txt=None):
+        self.name = name
+        self.host = host
+        self.port = port
+        self.txt = dict(txt or {})
+        self.lock = threading.Lock()
+        self.record = {}
+        self.updated = None
+        self.mode = "connecting"
+        self.error = None
+        self.messages = 0
+        self.stopped = threading.Event()
+        self.thread = threading.Thread(target=self.run, daemon=True)
+
+    def start(self):
+        self.thread.start()
+
+    def stop(self):
+        self.stopped.set()
+
+    def set_txt(self, txt):
+        with self.lock:
+            self.txt.update(txt)
+
+    def update(self, text):
+        record = parse_data(text)
+        with self.lock:
+            self.record = record
+            self.updated = time.time()
+            self.messages += 1
+            self.error = None
+
+    def run(self):
+        while not self.stopped.is_set():
+            try:
+                if not self.follow_events():
+                    self.poll()
+                    continue
+            except (OSError, http.client.HTTPException) as e:
+                with self.lock:
+                    self.mode = "offline"
+                    self.error = str(e) or e.__class__.__name__
+            self.stopped.wait(RETRY_INTERVAL)
+
+    def follow_events(self):
+        """Read the event stream until it ends, False if it is unsupported.
+
+        A scale with all /events slots taken sends the stream headers and
+        then closes, so a stream that ends before any data counts as
+        rejected too.
+        """
+        stream = self.txt.get("stream", "/events")
+        conn = http.client.HTTPConnection(self.host, self.port, timeout=TIMEOUT)
+        try:
+            conn.request("GET", stream, headers={"Accept": "text/event-stream"})
+            resp = conn.getresponse()
+            if resp.status != 200 or "event-stream" not in \
+                    resp.getheader("Content-Type", ""):
+                return False
+            event, data = None, []
+            received = False
+            while not self.stopped.is_set():
+                line = resp.fp.readline()
+                if not line:
+                    return received
+                line = line.decode("utf-8", "replace").rstrip("\r\n")
+                if not line:
+                    if data and event in (None, "data"):
+                        if not received:
+                            received = True
+                            with self.lock:
+                                self.mode = "events"
+                        self.update("\n".join(data))
+                    event, data = None, []
+                elif line.startswith("event:"):
+                    event = line[6:].strip()
+                elif line.startswith("data:"):
+                    data.append(line[5:].lstrip())
+            return True
+        finally:
+            conn.close()
+
+    def poll(self):
+        """Poll /get_data, trying the event stream again after a while."""
+        with self.lock:
+            self.mode = "polling"
+        end = time.monotonic() + EVENTS_RETRY
+        conn = http.client.HTTPConnection(self.host, self.port, timeout=TIMEOUT)
+        try:
+            while not self.stopped.is_set() and time.monotonic() < end:
+                conn.request("GET", "/get_data")
+                resp = conn.getresponse()
+                body = resp.read().decode("utf-8", "replace")
+                if resp.status == 200:
+                    self.update(body)
+                self.stopped.wait(POLL_INTERVAL)
+        finally:
+            conn.close()
+
+    def snapshot(self):
+        with self.lock:
+            age = time.time() - self.updated if self.updated else None
+            return {"name": self.name, "host": self.host, "port": self.port,
+                    "mode": self.mode, "error": self.error,
+                    "age": age, "messages": self.messages,
+                    "txt": dict(self.txt), "data": dict(self.record)}
+
+
+class Fleet:
+    def __init__(self):
+        self.lock = threading.Lock()
+        self.devices = {}
+
+    def add(self, name, host, port, txt=None):
+        with self.lock:
+            device = self.devices.get(name)
+            if device and (device.host, device.port) == (host, port):
+                device.set_txt(txt or {})
+                return
+            if device:
+                device.stop()
+            device = self.devices[name] = Device(name, host, port, txt)
+        print("Following %s at %s:%d" % (name, host, port))
+        device.start()
+
+    def remove(self, name):
+        with self.lock:
+            device = self.devices.pop(name, None)
+        if device:
+            print("Lost %s" % name)
+            device.stop()
+
+    def snapshot(self):
+        with self.lock:
+            devices = list(self.devices.values())
+        return sorted((d.snapshot() for d in devices), key=lambda d: d["name"])
+
+
+class Discovery:
+    """Browse for _http._tcp services announced by SmartScale firmware."""
+
+    def __init__(self, fleet):
+        from zeroconf import ServiceBrowser, Zeroconf
+        self.fleet = fleet
+        self.zeroconf = Zeroconf()
+        self.browser = ServiceBrowser(self.zeroconf, SERVICE_TYPE, self)
+
+    def resolve(self, zc, type_, name):
+        instance = name[:-len(type_) - 1] if name.endswith(type_) else name
+        if not instance.startswith(NAME_PREFIX):
+            return
+        info = zc.get_service_info(type_, name, 3000)
+        if not info or not info.addresses:
+            return
+        txt = {k.decode(): (v or b"").decode() for k, v in info.properties.items()}
+        self.fleet.add(instance, socket.inet_ntoa(info.addresses[0]), info.port,
+                       txt)
+
+    def add_service(self, zc, type_, name):
+        self.resolve(zc, type_, name)
+
+    def update_service(self, zc, type_, name):
+        self.resolve(zc, type_, name)
+
+    def remove_service(self, zc, type_, name):
+        self.fleet.remove(name[:-len(type_) - 1] if name.endswith(type_)
+                          else name)
+
+    def close(self):
+        self.zeroconf.close()
+
+
+PAGE = """<!DOCTYPE html>
+<html><head><meta charset="utf-8"><title>SmartScale fleet</title>
+<style>
+body { font-family: sans-serif; margin: 1em; }
+table { border-collapse: collapse; }
+th, td { padding: 0.3em 0.8em; border-bottom: 1px solid #ccc; text-align: right; }
+th:first-child, td:first-child { text-align: left; }
+.stale { color: #999; }
+</style></head>
+<body><h1>SmartScale fleet</h1>
+<table><thead><tr><th>Scale</th><th>Weight</th><th>Setpoint</th><th>Relay</th>
+<th>Time</th><th>Age</th><th>Link</th><th>Firmware</th></tr></thead>
+<tbody id="scales"></tbody></table>
+<script>
+function cell(row, text) { row.insertCell().textContent = text; }
+function refresh() {
+    fetch("/api/scales").then(r => r.json()).then(scales => {
+        const body = document.getElementById("scales");
+        body.innerHTML = "";
+        for (const s of scales) {
+            const row = body.insertRow();
+            const d = s.data;
+            if (s.age === null || s.age > 2) row.className = "stale";
+            cell(row, s.name);
+            cell(row, d.weight !== undefined ? d.weight.toFixed(1) + " g" : "-");
+            cell(row, s.txt.setpoint ? s.txt.setpoint + " g" : "-");
+            cell(row, d.relay === undefined ? "-" : (d.relay ? "cut" : "on"));
+            cell(row, d.elapsed !== undefined ? (d.elapsed / 1000).toFixed(1) + " s" : "-");
+            cell(row, s.age !== null ? s.age.toFixed(1) + " s" : "-");
+            cell(row, s.error ? s.mode + " (" + s.error + ")" : s.mode);
+            cell(row, s.txt.fw || "-");
+        }
+    }).finally(() => setTimeout(refresh, 500));
+}
+refresh();
+</script></body></html>
+"""
+
+
+def make_handler(fleet):
+    class Handler(BaseHTTPRequestHandler):
+        def send(self, status, ctype, body):
+            body = body.encode()
+            self.send_response(status)
+            self.send_header("Content-Type", ctype)
+            self.send_header("Content-Length", str(len(body)))
+            self.send_header("Cache-Control", "no-cache")
+            self.end_headers()
+            self.wfile.write(body)
+
+        def do_GET(self):
+            path = self.path.partition("?")[0]
+            if path == "/":
+                self.send(200, "text/html", PAGE)
+            elif path == "/api/scales":
+                self.send(200, "application/json", json.dumps(fleet.snapshot()))
+            else:
+                self.send(404, "text/plain", "Not found")
+
+        def log_message(self, format, *args):
+            pass
+
+    return Handler
+
+
+def parse_hostport(value, default_port):
+    host, _, port = value.rpartition(":")
+    if not host:
+        return value, default_port
+    return host, int(port)
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("--listen", default=":8000",
+                        help="address to serve the dashboard on (default :8000)")
+    parser.add_argument("--device", action="append", default=[],
+                        help="host[:port] of a scale, may be repeated")
+    parser.add_argument("--no-discover", action="store_true",
+                        help="only use the scales given with --device")
+    args = parser.parse_args()
+
+    fleet = Fleet()
+    for value in args.device:
+        host, port = parse_hostport(value, 80)
+        fleet.add("%s:%d" % (host, port), host, port)
+
+    discovery = None
+    if not args.no_discover:
+        try:
+            discovery = Discovery(fleet)
+        except ImportError:
+            print("zeroconf not installed, only using --device scales")
+
+    host, port = parse_hostport(args.listen, 8000)
+    server = ThreadingHTTPServer((host or "0.0.0.0", port), make_handler(fleet))
+    server.daemon_threads = True
+    print("Dashboard on http://%s:%d/" % (host or "0.0.0.0", port))
+    try:
+        server.serve_forever()
+    except KeyboardInterrupt:
+        pass
+    finally:
+        if discovery:
+            discovery.close()
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,115 @@
+#!/usr/bin/env python3
+"""Measure how old the weight served by the SmartScale is when it arrives.
+
+Estimates the offset to the scale's clock from the /time exchange with the
+lowest round trip, then polls /get_data from N clients. The age of every
+response is the local receive time, on the scale's clock, minus the
+sample's acquisition time. Reports the age distribution, and how many
+responses repeated an old sample or skipped samples.
+
+    ./latency_probe.py --host smartscale.local --clients 4 --duration 30
+"""
+
+import argparse
+import http.client
+import threading
+import time
+
+from loadtest import percentile, request
+
+
+def now_ms():
+    return time.monotonic() * 1000.0
+
+
+def clock_offset(host, rounds, timeout):
+    """Offset to add to local ms to get device ms, and its uncertainty."""
+    best = None
+    for _ in range(rounds):
+        sent = now_ms()
+        status, body = request(host, "/time", timeout)
+        received = now_ms()
+        if status != 200:
+            continue
+        rtt = received - sent
+        offset = int(body) - (sent + received) / 2.0
+        if best is None or rtt < best[1]:
+            best = (offset, rtt)
+        time.sleep(0.05)
+    if best is None:
+        raise SystemExit("could not read /time from %s" % host)
+    return best[0], best[1] / 2.0
+
+
+class Prober(threading.Thread):
+    def __init__(self, host, offset, interval, deadline, timeout):
+        super().__init__(daemon=True)
+        self.host = host
+        self.offset = offset
+        self.interval = interval
+        self.deadline = deadline
+        self.timeout = timeout
+        self.ages = []
+        self.repeats = 0
+        self.skipped = 0
+        self.errors = 0
+
+    def run(self):
+        last_seq = None
+        next_poll = time.monotonic()
+        while time.monotonic() < self.deadline:
+            try:
+                status, body = request(self.host, "/get_data", self.timeout)
+                received = now_ms()
+                fields = body.split(";")
+                if status != 200 or len(fields) < 8:
+                    self.errors += 1
+                else:
+                    seq, acquired = int(fields[6]), int(fields[7])
+                    self.ages.append(received + self.offset - acquired)
+                    if last_seq is not None:
+                        if seq == last_seq:
+                            self.repeats += 1
+                        elif seq > last_seq + 1:
+                            self.skipped += seq - last_seq - 1
+                    last_seq = seq
+            except (OSError, ValueError, http.client.HTTPException):
+                self.errors += 1
+            next_poll += self.interval
+            time.sleep(max(0.0, next_poll - time.monotonic()))
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("--host", default="smartscale.local",
+                        help="host[:port] of the scale or stand-in server")
+    parser.add_argument("--clients", type=int, default=1)
+    parser.add_argument("--duration", type=float, default=10.0)
+    parser.add_argument("--interval", type=float, default=0.1,
+                        help="poll interval per client in seconds")
+    parser.add_argument("--timeout", type=float, default=5.0)
+    args = parser.parse_args()
+
+    offset, error = clock_offset(args.host, 10, args.timeout)
+    print("clock offset %.1f ms (+/- %.1f ms)" % (offset, error))
+
+    deadline = time.monotonic() + args.duration
+    probers = [Prober(args.host, offset, args.interval, deadline, args.timeout)
+               for _ in range(args.clients)]
+    for p in probers:
+        p.start()
+    for p in probers:
+        p.join()
+
+    ages = [a for p in probers for a in p.ages]
+    print("responses %d, errors %d" % (len(ages), sum(p.errors for p in probers)))
+    if ages:
+        print("sample age ms: min %.1f p50 %.1f p90 %.1f p99 %.1f max %.1f" % (
+            min(ages), percentile(ages, 50), percentile(ages, 90),
+            percentile(ages, 99), max(ages)))
+    print("repeated samples %d, skipped samples %d (per client, summed)" % (
+        sum(p.repeats for p in probers), sum(p.skipped for p in probers)))
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,139 @@
+#!/usr/bin/env python3
+"""HTTP load test and latency benchmark for the SmartScale API.
+
+Runs N simulated web clients, each polling /get_data at the UI's 100 ms
+cadence and /weight and /tare_status in between, for every client count
+given. Before each run the device's /perf counters are reset and after
+it they are read back, so each row also shows the free heap, the
+worst-case delay from a load cell sample to the relay decision and the
+longest loop() period seen while the request storm was running.
+
+    ./loadtest.py --host smartscale.local --clients 1,2,4,8,16
+    ./loadtest.py --host 127.0.0.1:8080          # against fake_scale.py
+"""
+
+import argparse
+import http.client
+import threading
+import time
+
+PATHS = ("/get_data", "/weight", "/tare_status")
+
+
+def request(host, path, timeout):
+    conn = http.client.HTTPConnection(host, timeout=timeout)
+    try:
+        conn.request("GET", path)
+        resp = conn.getresponse()
+        body = resp.read().decode(errors="replace")
+        return resp.status, body
+    finally:
+        conn.close()
+
+
+def percentile(values, p):
+    if not values:
+        return float("nan")
+    values = sorted(values)
+    index = min(len(values) - 1, int(round(p / 100.0 * (len(values) - 1))))
+    return values[index]
+
+
+class Client(threading.Thread):
+    def __init__(self, host, interval, deadline, timeout):
+        super().__init__(daemon=True)
+        self.host = host
+        self.interval = interval
+        self.deadline = deadline
+        self.timeout = timeout
+        self.latencies = []
+        self.errors = 0
+
+    def run(self):
+        i = 0
+        next_poll = time.monotonic()
+        while time.monotonic() < self.deadline:
+            # /get_data every poll, the other routes every third poll
+            path = PATHS[0] if i % 3 != 2 else PATHS[1 + (i // 3) % 2]
+            start = time.monotonic()
+            try:
+                status, _ = request(self.host, path, self.timeout)
+                if status != 200:
+                    self.errors += 1
+                else:
+                    self.latencies.append(time.monotonic() - start)
+            except (OSError, http.client.HTTPException):
+                self.errors += 1
+            i += 1
+            next_poll += self.interval
+            time.sleep(max(0.0, next_poll - time.monotonic()))
+
+
+def read_perf(host, reset, timeout):
+    path = "/perf?reset=1" if reset else "/perf"
+    try:
+        status, body = request(host, path, timeout)
+    except (OSError, http.client.HTTPException):
+        return None
+    if status != 200:
+        return None
+    heap, latency, loop_time = (int(v) for v in body.split(";")[:3])
+    return heap, latency, loop_time
+
+
+def run(host, clients, duration, interval, timeout):
+    read_perf(host, True, timeout)
+    deadline = time.monotonic() + duration
+    threads = [Client(host, interval, deadline, timeout) for _ in range(clients)]
+    start = time.monotonic()
+    for t in threads:
+        t.start()
+    for t in threads:
+        t.join()
+    elapsed = time.monotonic() - start
+    perf = read_perf(host, False, timeout)
+
+    latencies = [l for t in threads for l in t.latencies]
+    errors = sum(t.errors for t in threads)
+    return {
+        "clients": clients,
+        "rps": len(latencies) / elapsed,
+        "p50": percentile(latencies, 50) * 1000,
+        "p99": percentile(latencies, 99) * 1000,
+        "errors": errors,
+        "heap": perf[0] if perf else None,
+        "decision": perf[1] / 1000.0 if perf else None,
+        "loop": perf[2] / 1000.0 if perf else None,
+    }
+
+
+def fmt(value, spec):
+    return "n/a" if value is None else format(value, spec)
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("--host", default="smartscale.local",
+                        help="host[:port] of the scale or stand-in server")
+    parser.add_argument("--clients", default="1,2,4,8",
+                        help="comma separated list of client counts to run")
+    parser.add_argument("--duration", type=float, default=10.0,
+                        help="seconds per run")
+    parser.add_argument("--interval", type=float, default=0.1,
+                        help="poll interval per client in seconds")
+    parser.add_argument("--timeout", type=float, default=5.0)
+    args = parser.parse_args()
+
+    print("%7s %8s %8s %8s %6s %8s %12s %9s" % (
+        "clients", "req/s", "p50 ms", "p99 ms", "errors", "heap",
+        "decision ms", "loop ms"))
+    for n in (int(c) for c in args.clients.split(",")):
+        r = run(args.host, n, args.duration, args.interval, args.timeout)
+        print("%7d %8.1f %8.1f %8.1f %6d %8s %12s %9s" % (
+            r["clients"], r["rps"], r["p50"], r["p99"], r["errors"],
+            fmt(r["heap"], "d"), fmt(r["decision"], ".1f"),
+            fmt(r["loop"], ".1f")))
+
+
+if __name__ == "__main__":
+    main()
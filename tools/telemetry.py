@@ -0,0 +1,217 @@
+#!/usr/bin/env python3
+"""Decoder for the SmartScale binary serial telemetry.
+
+Switches the scale into machine mode (the 'b' console command), then
+decodes the COBS framed packets and writes every sample and event as CSV.
+Commands can be sent with the same framing. Needs pyserial to talk to a
+serial port; --input decodes a raw capture file instead.
+
+    ./telemetry.py --port /dev/ttyUSB0 --output shots.csv
+    ./telemetry.py --port /dev/ttyUSB0 --tare --setpoint 18.5
+    ./telemetry.py --input capture.bin
+"""
+
+import argparse
+import csv
+import struct
+import sys
+import time
+
+CONSOLE_BAUD = 9600
+TELEMETRY_BAUD = 921600
+
+PKT_SAMPLE = 0x01
+PKT_EVENT = 0x02
+PKT_STATUS = 0x03
+PKT_ACK = 0x04
+
+CMD_TARE = 0x81
+CMD_SETPOINT = 0x82
+CMD_RESET_RELAY = 0x83
+CMD_SET_RELAY = 0x84
+CMD_STATUS = 0x85
+CMD_EXIT = 0x86
+
+EVENTS = {
+    1: "relay",
+    2: "grind_start",
+    3: "cutoff",
+    4: "shot",
+    5: "tare",
+    6: "setpoint",
+}
+
+FIELDS = ["kind", "seq", "time_ms", "weight", "relay", "event", "value"]
+
+
+def crc8(data):
+    crc = 0
+    for b in data:
+        crc ^= b
+        for _ in range(8):
+            crc = ((crc << 1) ^ 0x07) & 0xFF if crc & 0x80 else (crc << 1) & 0xFF
+    return crc
+
+
+def cobs_encode(data):
+    out = bytearray([0])
+    code_pos, code = 0, 1
+    for b in data:
+        if b == 0:
+            out[code_pos] = code
+            code_pos, code = len(out), 1
+            out.append(0)
+        else:
+            out.append(b)
+            code += 1
+            if code == 0xFF:
+                out[code_pos] = code
+                code_pos, code = len(out), 1
+                out.append(0)
+    out[code_pos] = code
+    return bytes(out) + b"\0"
+
+
+def cobs_decode(frame):
+    out = bytearray()
+    i = 0
+    while i < len(frame):
+        code = frame[i]
+        i += 1
+        if code == 0 or i + code - 1 > len(frame):
+            return None
+        out += frame[i:i + code - 1]
+        i += code - 1
+        if code != 0xFF and i < len(frame):
+            out.append(0)
+    return bytes(out)
+
+
+def command(cmd, payload=b""):
+    packet = bytes([cmd]) + payload
+    return cobs_encode(packet + bytes([crc8(packet)]))
+
+
+class Decoder:
+    def __init__(self):
+        self.buf = bytearray()
+        self.bad_frames = 0
+        self.last_seq = None
+        self.lost_samples = 0
+
+    def feed(self, data):
+        """Yield decoded (type, payload) tuples for complete frames."""
+        self.buf += data
+        while True:
+            end = self.buf.find(b"\0")
+            if end < 0:
+                return
+            frame, self.buf = bytes(self.buf[:end]), self.buf[end + 1:]
+            if not frame:
+                continue
+            packet = cobs_decode(frame)
+            if packet is None or len(packet) < 2 or crc8(packet[:-1]) != packet[-1]:
+                self.bad_frames += 1
+                continue
+            yield packet[0], packet[1:-1]
+
+
+    def check_seq(self, seq):
+        """Count samples missing from the stream, dropped on either side."""
+        if self.last_seq is not None and seq != (self.last_seq + 1) & 0xFFFFFFFF:
+            self.lost_samples += (seq - self.last_seq - 1) & 0xFFFFFFFF
+        self.last_seq = seq
+
+
+def to_row(decoder, ptype, payload):
+    if ptype == PKT_SAMPLE and len(payload) == 13:
+        seq, t, w, relay = struct.unpack("<IIfB", payload)
+        decoder.check_seq(seq)
+        return {"kind": "sample", "seq": seq, "time_ms": t,
+                "weight": "%.3f" % w, "relay": relay}
+    if ptype == PKT_EVENT and len(payload) == 9:
+        t, ev, value = struct.unpack("<IBf", payload)
+        return {"kind": "event", "time_ms": t,
+                "event": EVENTS.get(ev, str(ev)), "value": "%.3f" % value}
+    if ptype == PKT_STATUS and len(payload) == 16:
+        dropped, setpoint, cal, threshold = struct.unpack("<Ifff", payload)
+        print("status: dropped=%d setpoint=%.1f calibration=%.1f threshold=%.2f"
+              % (dropped, setpoint, cal, threshold), file=sys.stderr)
+    elif ptype == PKT_ACK and len(payload) == 2:
+        print("ack: command 0x%02X %s" % (payload[0], "ok" if payload[1] else "failed"),
+              file=sys.stderr)
+    return None
+
+
+def open_port(name):
+    import serial  # pyserial
+
+    port = serial.Serial(name, CONSOLE_BAUD, timeout=0.1)
+    port.write(b"b")
+    port.flush()
+    time.sleep(0.2)
+    port.baudrate = TELEMETRY_BAUD
+    port.reset_input_buffer()
+    return port
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    source = parser.add_mutually_exclusive_group(required=True)
+    source.add_argument("--port", help="serial port of the scale")
+    source.add_argument("--input", help="raw capture file to decode")
+    parser.add_argument("--output", help="CSV file (default stdout)")
+    parser.add_argument("--duration", type=float,
+                        help="stop after this many seconds")
+    parser.add_argument("--tare", action="store_true")
+    parser.add_argument("--setpoint", type=float)
+    parser.add_argument("--reset-relay", action="store_true")
+    parser.add_argument("--exit", action="store_true",
+                        help="return the scale to the text console when done")
+    args = parser.parse_args()
+
+    out = open(args.output, "w", newline="") if args.output else sys.stdout
+    writer = csv.DictWriter(out, FIELDS)
+    writer.writeheader()
+    decoder = Decoder()
+
+    if args.input:
+        with open(args.input, "rb") as f:
+            for ptype, payload in decoder.feed(f.read()):
+                row = to_row(decoder, ptype, payload)
+                if row:
+                    writer.writerow(row)
+    else:
+        port = open_port(args.port)
+        port.write(command(CMD_STATUS))
+        if args.tare:
+            port.write(command(CMD_TARE))
+        if args.setpoint is not None:
+            port.write(command(CMD_SETPOINT, struct.pack("<f", args.setpoint)))
+        if args.reset_relay:
+            port.write(command(CMD_RESET_RELAY))
+        end = time.monotonic() + args.duration if args.duration else None
+        try:
+            while end is None or time.monotonic() < end:
+                for ptype, payload in decoder.feed(port.read(4096)):
+                    row = to_row(decoder, ptype, payload)
+                    if row:
+                        writer.writerow(row)
+        except KeyboardInterrupt:
+            pass
+        if args.exit:
+            port.write(command(CMD_EXIT))
+            port.flush()
+        port.close()
+
+    if decoder.lost_samples:
+        print("%d samples missing from the sequence" % decoder.lost_samples,
+              file=sys.stderr)
+    if decoder.bad_frames:
+        print("%d corrupt frames skipped" % decoder.bad_frames, file=sys.stderr)
+    if args.output:
+        out.close()
+
+
+if __name__ == "__main__":
+    main()
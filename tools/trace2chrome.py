@@ -0,0 +1,98 @@
+#!/usr/bin/env python3
+"""Convert a SmartScale /trace download to Chrome trace event JSON.
+
+The output opens in chrome://tracing or https://ui.perfetto.dev. The
+firmware must be built with -DTRACE_ENABLE.
+
+    curl -o trace.bin http://smartscale.local/trace
+    ./trace2chrome.py trace.bin > trace.json
+    curl http://smartscale.local/trace?arm=1      # record the next one
+"""
+
+import argparse
+import json
+import struct
+import sys
+
+MAGIC = b"STRC"
+
+# Must match enum trace_id_e in include/trace.h
+NAMES = [
+    "isr",
+    "loadcell_update",
+    "filter",
+    "control_loop",
+    "decision",
+    "relay",
+    "http",
+    "flash_commit",
+    "mdns_update",
+    "telemetry",
+    "trigger",
+]
+
+# The data ready interrupt gets its own track
+ISR_IDS = {0}
+
+PHASES = {0: "B", 1: "E", 2: "i"}
+
+
+def convert(data):
+    if len(data) < 8 or data[:4] != MAGIC:
+        raise ValueError("not a SmartScale trace")
+    version, mhz, count = struct.unpack_from("<BBH", data, 4)
+    if version != 1:
+        raise ValueError("unsupported trace version %d" % version)
+
+    events = []
+    cycles = None
+    prev = 0
+    for i in range(count):
+        raw, ident, etype, _ = struct.unpack_from("<IBBH", data, 8 + 8 * i)
+        # Unwrap the 32-bit cycle counter, spans may be recorded slightly
+        # out of order so take the signed difference to the previous event
+        if cycles is None:
+            cycles = 0
+        else:
+            delta = (raw - prev) & 0xFFFFFFFF
+            if delta >= 1 << 31:
+                delta -= 1 << 32
+            cycles += delta
+        prev = raw
+
+        name = NAMES[ident] if ident < len(NAMES) else "id%d" % ident
+        event = {
+            "name": name,
+            "ph": PHASES.get(etype, "i"),
+            "ts": cycles / float(mhz),
+            "pid": 1,
+            "tid": 2 if ident in ISR_IDS else 1,
+        }
+        if event["ph"] == "i":
+            event["s"] = "g" if name == "trigger" else "t"
+        events.append(event)
+
+    events.sort(key=lambda e: e["ts"])
+    events.insert(0, {"name": "thread_name", "ph": "M", "pid": 1, "tid": 1,
+                      "args": {"name": "loop"}})
+    events.insert(1, {"name": "thread_name", "ph": "M", "pid": 1, "tid": 2,
+                      "args": {"name": "isr"}})
+    return {"traceEvents": events, "displayTimeUnit": "ms"}
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("input", help="binary trace from the /trace endpoint")
+    parser.add_argument("-o", "--output", help="JSON file (default stdout)")
+    args = parser.parse_args()
+
+    with open(args.input, "rb") as f:
+        trace = convert(f.read())
+    out = open(args.output, "w") if args.output else sys.stdout
+    json.dump(trace, out)
+    if args.output:
+        out.close()
+
+
+if __name__ == "__main__":
+    main()